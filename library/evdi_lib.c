@@ -18,15 +18,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 // ********************* Private part **************************
 
 #define MAX_DIRTS           16
+#define MAX_HEADS           16
 #define EVDI_INVALID_DEVICE_INDEX -1
 
 #define EVDI_MODULE_COMPATIBILITY_VERSION_MAJOR 1
@@ -55,9 +59,22 @@ struct evdi_frame_buffer_node {
 
 struct evdi_device_context {
 	int fd;
+	int head;
+	/* Handle owning the fd, the one of head 0 */
+	struct evdi_device_context *device;
+	/* Handles opened for each head, kept by the device handle */
+	struct evdi_device_context *heads[MAX_HEADS];
+	/* Head of the event being dispatched, kept by the device handle */
+	int event_head;
 	int bufferToUpdate;
 	struct evdi_frame_buffer_node *frameBuffersListHead;
 	int device_index;
+	uint32_t event_mask;
+	bool event_mask_unsupported;
+	/* Set until connecting, as only the connected client may subscribe */
+	bool event_mask_denied;
+	struct evdi_update_summary update_summary;
+	bool has_update_summary;
 };
 
 #define EVDI_USAGE_LEN 64
@@ -220,6 +237,26 @@ static int is_evdi(int fd)
 	return 0;
 }
 
+static int read_device_attribute(int device_index, const char *name,
+				 int fallback)
+{
+	char path[PATH_MAX];
+	FILE *file;
+	int value;
+
+	snprintf(path, PATH_MAX, "/sys/class/drm/card%d/device/%s",
+		 device_index, name);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return fallback;
+
+	if (fscanf(file, "%d", &value) != 1)
+		value = fallback;
+	fclose(file);
+
+	return value;
+}
+
 static int path_exists(const char *path)
 {
 	struct stat buf;
@@ -580,7 +617,10 @@ evdi_handle evdi_open(int device)
 			h = calloc(1, sizeof(struct evdi_device_context));
 			if (h) {
 				h->fd = fd;
+				h->device = h;
+				h->heads[0] = h;
 				h->device_index = device;
+				h->event_mask = EVDI_EVENT_MASK_ALL;
 				card_usage[device] = h;
 				evdi_log("Using /dev/dri/card%d", device);
 			}
@@ -661,8 +701,60 @@ evdi_handle evdi_open_attached_to_fixed(const char *sysfs_parent_device, size_t
 }
 
 
+evdi_handle evdi_open_head(evdi_handle handle, int head)
+{
+	evdi_handle device, h;
+
+	if (handle == EVDI_INVALID_HANDLE)
+		return EVDI_INVALID_HANDLE;
+
+	device = handle->device;
+	if (head <= 0 || head >= evdi_get_head_count(device)) {
+		evdi_log("No head %d on /dev/dri/card%d", head,
+			 device->device_index);
+		return EVDI_INVALID_HANDLE;
+	}
+
+	if (device->heads[head]) {
+		evdi_log("Head %d of /dev/dri/card%d is already open", head,
+			 device->device_index);
+		return EVDI_INVALID_HANDLE;
+	}
+
+	h = calloc(1, sizeof(struct evdi_device_context));
+	if (h) {
+		h->fd = device->fd;
+		h->head = head;
+		h->device = device;
+		h->device_index = device->device_index;
+		h->event_mask = EVDI_EVENT_MASK_ALL;
+		device->heads[head] = h;
+		evdi_log("Using head %d of /dev/dri/card%d", head,
+			 device->device_index);
+	}
+	return h;
+}
+
+int evdi_get_head_count(evdi_handle handle)
+{
+	return read_device_attribute(handle->device_index, "heads", 1);
+}
+
+int evdi_get_event_head(evdi_handle handle)
+{
+	return handle->device->event_head;
+}
+
 void evdi_close(evdi_handle handle)
 {
+	if (handle != EVDI_INVALID_HANDLE && handle->device != handle) {
+		/* The fd stays with the handle of head 0 */
+		handle->device->heads[handle->head] = EVDI_INVALID_HANDLE;
+		removeFrameBuffer(handle, NULL);
+		free(handle);
+		return;
+	}
+
 	if (handle != EVDI_INVALID_HANDLE) {
 		close(handle->fd);
 		free(handle);
@@ -696,22 +788,29 @@ void evdi_connect2(evdi_handle handle,
 		.edid_length = edid_length,
 		.pixel_area_limit = pixel_area_limit,
 		.pixel_per_second_limit = pixel_per_second_limit,
+		.head = handle->head,
 	};
 
 	do_ioctl(handle->fd, DRM_IOCTL_EVDI_CONNECT, &cmd, "connect");
+	/* Kernel resets the subscription for the new client as well */
+	handle->event_mask = EVDI_EVENT_MASK_ALL;
+	handle->event_mask_denied = false;
 }
 
 void evdi_disconnect(evdi_handle handle)
 {
-	struct drm_evdi_connect cmd = { 0, 0, 0, 0, 0, 0 };
+	struct drm_evdi_connect cmd = { .head = handle->head };
 
 	do_ioctl(handle->fd, DRM_IOCTL_EVDI_CONNECT, &cmd, "disconnect");
+	/* Kernel resets the subscription when the client disconnects */
+	handle->event_mask = EVDI_EVENT_MASK_ALL;
 }
 
 void evdi_enable_cursor_events(evdi_handle handle, bool enable)
 {
 	struct drm_evdi_enable_cursor_events cmd = {
 		.enable = enable,
+		.head = handle->head,
 	};
 
 	evdi_log("%s cursor events on /dev/dri/card%d",
@@ -730,6 +829,7 @@ void evdi_grab_pixels(evdi_handle handle,
 	struct evdi_buffer *destinationBuffer = NULL;
 
 	destinationNode = findBuffer(handle, handle->bufferToUpdate);
+	handle->has_update_summary = false;
 
 	if (!destinationNode) {
 		evdi_log("Buffer %d not found. Not grabbing.",
@@ -747,7 +847,8 @@ void evdi_grab_pixels(evdi_handle handle,
 		destinationBuffer->stride,
 		destinationBuffer->buffer,
 		MAX_DIRTS,
-		kernelDirts
+		kernelDirts,
+		handle->head
 	};
 
 	if (do_ioctl(
@@ -775,6 +876,57 @@ void evdi_grab_pixels(evdi_handle handle,
 	}
 }
 
+bool evdi_wait_and_grab(evdi_handle handle,
+			int bufferId,
+			int timeout_ms,
+			struct evdi_rect *rects,
+			int *num_rects)
+{
+	struct drm_clip_rect kernelDirts[MAX_DIRTS] = { { 0, 0, 0, 0 } };
+	struct evdi_frame_buffer_node *destinationNode = NULL;
+	struct evdi_buffer *destinationBuffer = NULL;
+
+	*num_rects = 0;
+
+	destinationNode = findBuffer(handle, bufferId);
+	if (!destinationNode) {
+		evdi_log("Buffer %d not found. Not grabbing.", bufferId);
+		return false;
+	}
+
+	destinationBuffer = &destinationNode->frame_buffer;
+	handle->bufferToUpdate = bufferId;
+	handle->has_update_summary = false;
+
+	struct drm_evdi_wait_and_grab grab = {
+		.mode = EVDI_GRABPIX_MODE_DIRTY,
+		.buf_width = destinationBuffer->width,
+		.buf_height = destinationBuffer->height,
+		.buf_byte_stride = destinationBuffer->stride,
+		.buffer = destinationBuffer->buffer,
+		.num_rects = MAX_DIRTS,
+		.rects = kernelDirts,
+		.timeout_ms = timeout_ms,
+		.head = handle->head,
+	};
+
+	if (drm_ioctl(handle->fd, DRM_IOCTL_EVDI_WAIT_AND_GRAB, &grab) != 0) {
+		if (errno != ETIMEDOUT)
+			evdi_log("Ioctl wait_and_grab error: %s", strerror(errno));
+		return false;
+	}
+
+	for (int r = 0; r < grab.num_rects; ++r) {
+		rects[r].x1 = kernelDirts[r].x1;
+		rects[r].y1 = kernelDirts[r].y1;
+		rects[r].x2 = kernelDirts[r].x2;
+		rects[r].y2 = kernelDirts[r].y2;
+	}
+	*num_rects = grab.num_rects;
+
+	return true;
+}
+
 void evdi_register_buffer(evdi_handle handle, struct evdi_buffer buffer)
 {
 	assert(handle);
@@ -800,7 +952,7 @@ bool evdi_request_update(evdi_handle handle, int bufferId)
 	assert(handle);
 	handle->bufferToUpdate = bufferId;
 	{
-		struct drm_evdi_request_update cmd;
+		struct drm_evdi_request_update cmd = { .head = handle->head };
 		const int requestResult = do_ioctl(
 			handle->fd,
 			DRM_IOCTL_EVDI_REQUEST_UPDATE,
@@ -820,6 +972,7 @@ void evdi_ddcci_response(evdi_handle handle, const unsigned char *buffer,
 		.buffer = buffer,
 		.buffer_length = buffer_length,
 		.result = result,
+		.head = handle->head,
 	};
 
 	do_ioctl(handle->fd, DRM_IOCTL_EVDI_DDCCI_RESPONSE, &cmd,
@@ -875,8 +1028,9 @@ static struct evdi_cursor_set to_evdi_cursor_set(
 			return cursor_set;
 		}
 
+		/* The whole buffer is read at once, so map it in one go */
 		void *ptr = mmap(0, size, PROT_READ,
-				 MAP_SHARED, handle->fd, offset);
+				 MAP_SHARED | MAP_POPULATE, handle->fd, offset);
 
 		if (ptr != MAP_FAILED) {
 			cursor_set.buffer = malloc(size);
@@ -915,12 +1069,31 @@ static struct evdi_ddcci_data to_evdi_ddcci_data(
 	return ddcci_data;
 }
 
+static void store_update_summary(evdi_handle handle, struct drm_event *e)
+{
+	struct drm_evdi_event_update_ready *event =
+		(struct drm_evdi_event_update_ready *) e;
+
+	/* Modules older than the summary send the bare header */
+	handle->has_update_summary = e->length >= sizeof(*event);
+	if (!handle->has_update_summary)
+		return;
+
+	handle->update_summary.num_rects = event->num_rects;
+	handle->update_summary.bounds.x1 = event->bounds.x1;
+	handle->update_summary.bounds.y1 = event->bounds.y1;
+	handle->update_summary.bounds.x2 = event->bounds.x2;
+	handle->update_summary.bounds.y2 = event->bounds.y2;
+	handle->update_summary.area = event->area;
+}
+
 static void evdi_handle_event(evdi_handle handle,
 			      struct evdi_event_context *evtctx,
 			      struct drm_event *e)
 {
 	switch (e->type) {
 	case DRM_EVDI_EVENT_UPDATE_READY:
+		store_update_summary(handle, e);
 		if (evtctx->update_ready_handler)
 			evtctx->update_ready_handler(handle->bufferToUpdate,
 						     evtctx->user_data);
@@ -998,25 +1171,143 @@ static void evdi_handle_event(evdi_handle handle,
 	}
 }
 
-void evdi_handle_events(evdi_handle handle, struct evdi_event_context *evtctx)
+static uint32_t to_event_mask(const struct evdi_event_context *evtctx)
 {
+	uint32_t mask = 0;
+
+	if (evtctx->update_ready_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_UPDATE_READY);
+	if (evtctx->dpms_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_DPMS);
+	if (evtctx->mode_changed_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_MODE_CHANGED);
+	if (evtctx->crtc_state_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_CRTC_STATE);
+	if (evtctx->cursor_set_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_CURSOR_SET);
+	if (evtctx->cursor_move_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_CURSOR_MOVE);
+	if (evtctx->ddcci_data_handler)
+		mask |= EVDI_EVENT_MASK_BIT(DRM_EVDI_EVENT_DDCCI_DATA);
+
+	return mask;
+}
+
+/*
+ * @brief Subscribes only to events which have a handler in the context.
+ * Modules without the ioctl keep sending everything, which is harmless
+ */
+static void update_event_mask(evdi_handle handle,
+			      const struct evdi_event_context *evtctx)
+{
+	struct drm_evdi_set_event_mask cmd = {
+		.mask = to_event_mask(evtctx),
+		.head = handle->head,
+	};
+
+	if (handle->event_mask_unsupported || handle->event_mask_denied ||
+	    handle->event_mask == cmd.mask)
+		return;
+
+	if (drm_ioctl(handle->fd, DRM_IOCTL_EVDI_SET_EVENT_MASK, &cmd) == 0) {
+		handle->event_mask = cmd.mask;
+	} else if (errno == EINVAL || errno == ENOTTY) {
+		evdi_log("Event subscription not supported by the kernel module");
+		handle->event_mask_unsupported = true;
+	} else if (errno == EACCES) {
+		handle->event_mask_denied = true;
+	} else {
+		evdi_log("Ioctl set_event_mask error: %s", strerror(errno));
+	}
+}
+
+#define EVENT_HEAD(e, type) \
+	((e)->length >= offsetof(type, head) + sizeof(int32_t) ? \
+	 ((type *)(e))->head : 0)
+
+/* Modules older than heads send events of head 0 without the field */
+static int event_head(struct drm_event *e)
+{
+	switch (e->type) {
+	case DRM_EVDI_EVENT_UPDATE_READY:
+		return EVENT_HEAD(e, struct drm_evdi_event_update_ready);
+	case DRM_EVDI_EVENT_DPMS:
+		return EVENT_HEAD(e, struct drm_evdi_event_dpms);
+	case DRM_EVDI_EVENT_MODE_CHANGED:
+		return EVENT_HEAD(e, struct drm_evdi_event_mode_changed);
+	case DRM_EVDI_EVENT_CRTC_STATE:
+		return EVENT_HEAD(e, struct drm_evdi_event_crtc_state);
+	case DRM_EVDI_EVENT_CURSOR_SET:
+		return EVENT_HEAD(e, struct drm_evdi_event_cursor_set);
+	case DRM_EVDI_EVENT_CURSOR_MOVE:
+		return EVENT_HEAD(e, struct drm_evdi_event_cursor_move);
+	case DRM_EVDI_EVENT_DDCCI_DATA:
+		return EVENT_HEAD(e, struct drm_evdi_event_ddcci_data);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * @brief Reads and dispatches all pending events of a device. Events of
+ * every open head are read from the shared fd and dispatched with the
+ * handle of their head, which evdi_get_event_head tells the handlers.
+ * @return true if an update_ready notification was among them
+ */
+static bool handle_events(evdi_handle handle,
+			  struct evdi_event_context *evtctx)
+{
+	evdi_handle device = handle->device;
 	char buffer[1024];
 	int i = 0;
+	bool update_ready = false;
 
 	int bytesRead = read(handle->fd, buffer, sizeof(buffer));
 
 	if (!evtctx) {
 		evdi_log("Error: Event context is null!");
-		return;
+		return false;
+	}
+
+	for (int head = 0; head < MAX_HEADS; ++head) {
+		if (device->heads[head])
+			update_event_mask(device->heads[head], evtctx);
 	}
 
 	while (i < bytesRead) {
 		struct drm_event *e = (struct drm_event *) &buffer[i];
+		const int head = event_head(e);
+		evdi_handle target = head >= 0 && head < MAX_HEADS &&
+				     device->heads[head] ?
+				     device->heads[head] : device;
+
+		if (e->type == DRM_EVDI_EVENT_UPDATE_READY)
+			update_ready = true;
 
-		evdi_handle_event(handle, evtctx, e);
+		device->event_head = head;
+		evdi_handle_event(target, evtctx, e);
 
 		i += e->length;
 	}
+
+	return update_ready;
+}
+
+void evdi_handle_events(evdi_handle handle, struct evdi_event_context *evtctx)
+{
+	handle_events(handle, evtctx);
+}
+
+bool evdi_get_update_summary(evdi_handle handle,
+			     struct evdi_update_summary *summary)
+{
+	assert(handle);
+
+	if (!handle->has_update_summary || !summary)
+		return false;
+
+	*summary = handle->update_summary;
+	return true;
 }
 
 evdi_selectable evdi_get_event_ready(evdi_handle handle)
@@ -1024,6 +1315,44 @@ evdi_selectable evdi_get_event_ready(evdi_handle handle)
 	return handle->fd;
 }
 
+/* Must match the pitch of dumb buffers, see evdi_align_pitch in the module */
+int evdi_get_buffer_pitch(evdi_handle handle, int width, int bits_per_pixel)
+{
+	const int cpp = (bits_per_pixel + 7) / 8;
+	const int align = read_device_attribute(handle->device_index,
+						"pitch_alignment", 0);
+	const int stagger = read_device_attribute(handle->device_index,
+						  "pitch_stagger", 0);
+	int pitch_mask = 0;
+	int pitch, unit;
+
+	switch (cpp) {
+	case 1:
+		pitch_mask = 255;
+		break;
+	case 2:
+		pitch_mask = 127;
+		break;
+	case 3:
+	case 4:
+		pitch_mask = 63;
+		break;
+	}
+
+	if (align > 0) {
+		unit = align;
+		pitch = (width * cpp + align - 1) & ~(align - 1);
+	} else {
+		unit = (pitch_mask + 1) * cpp;
+		pitch = ((width + pitch_mask) & ~pitch_mask) * cpp;
+	}
+
+	if (stagger && pitch % 4096 == 0 && unit % 4096 != 0)
+		pitch += unit;
+
+	return pitch;
+}
+
 void evdi_get_lib_version(struct evdi_lib_version *version)
 {
 	if (version != NULL) {
@@ -1037,3 +1366,355 @@ void evdi_set_logging(struct evdi_logging evdi_logging)
 {
 	g_evdi_logging = evdi_logging;
 }
+
+// ********************* Event loop **************************
+
+#define EVDI_LOOP_MAX_EVENTS (2 * EVDI_USAGE_LEN)
+#define NSEC_PER_SEC 1000000000ULL
+
+struct evdi_loop_device;
+
+struct evdi_loop_source {
+	struct evdi_loop_device *device;
+	bool is_timer;
+};
+
+struct evdi_loop_device {
+	evdi_handle handle;
+	struct evdi_event_context evtctx;
+	int buffer_id;
+
+	int timer_fd;
+	uint64_t frame_interval_ns;
+	uint64_t last_request_ns;
+
+	bool update_requested;
+	bool update_ready;
+	bool waiting_for_timer;
+	bool removed;
+
+	struct evdi_loop_source device_source;
+	struct evdi_loop_source timer_source;
+	struct evdi_loop_device *next;
+};
+
+struct evdi_loop {
+	int epoll_fd;
+	bool dispatching;
+	struct evdi_loop_device *devices;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct evdi_loop_device *find_loop_device(evdi_loop_handle loop,
+						 evdi_handle handle)
+{
+	struct evdi_loop_device *device = NULL;
+
+	for (device = loop->devices; device != NULL; device = device->next) {
+		if (device->handle == handle && !device->removed)
+			return device;
+	}
+
+	return NULL;
+}
+
+static void arm_loop_timer(struct evdi_loop_device *device, uint64_t when_ns)
+{
+	struct itimerspec its = {
+		.it_interval = { 0, 0 },
+		.it_value = {
+			.tv_sec = when_ns / NSEC_PER_SEC,
+			.tv_nsec = when_ns % NSEC_PER_SEC,
+		},
+	};
+
+	if (timerfd_settime(device->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+		evdi_log("Failed to arm frame timer on /dev/dri/card%d: %s",
+			 device->handle->device_index, strerror(errno));
+		return;
+	}
+	device->waiting_for_timer = true;
+}
+
+/*
+ * @brief Issues the next update request for a device unless one is already
+ * in flight, the device is paused or the frame timer has not expired yet
+ */
+static void loop_request_update(struct evdi_loop_device *device)
+{
+	if (device->buffer_id < 0 ||
+	    !device->evtctx.update_ready_handler ||
+	    device->update_requested ||
+	    device->update_ready ||
+	    device->waiting_for_timer)
+		return;
+
+	if (device->frame_interval_ns) {
+		const uint64_t now = monotonic_ns();
+		const uint64_t next = device->last_request_ns +
+				      device->frame_interval_ns;
+
+		if (device->last_request_ns && now < next) {
+			arm_loop_timer(device, next);
+			return;
+		}
+		device->last_request_ns = now;
+	}
+
+	if (evdi_request_update(device->handle, device->buffer_id))
+		device->update_ready = true;
+	else
+		device->update_requested = true;
+}
+
+static void free_loop_device(evdi_loop_handle loop,
+			     struct evdi_loop_device *device)
+{
+	struct evdi_loop_device **node = NULL;
+
+	for (node = &loop->devices; *node != NULL; node = &(*node)->next) {
+		if (*node == device) {
+			*node = device->next;
+			break;
+		}
+	}
+
+	if (device->timer_fd >= 0)
+		close(device->timer_fd);
+	free(device);
+}
+
+static void remove_loop_device(evdi_loop_handle loop,
+			       struct evdi_loop_device *device)
+{
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, device->handle->fd, NULL);
+	if (device->timer_fd >= 0)
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, device->timer_fd, NULL);
+
+	device->removed = true;
+	if (!loop->dispatching)
+		free_loop_device(loop, device);
+}
+
+static void handle_loop_source(struct evdi_loop_source *source)
+{
+	struct evdi_loop_device *device = source->device;
+
+	if (device->removed)
+		return;
+
+	if (source->is_timer) {
+		uint64_t expirations = 0;
+
+		if (read(device->timer_fd, &expirations,
+			 sizeof(expirations)) < 0 && errno != EAGAIN)
+			evdi_log("Failed to read frame timer on /dev/dri/card%d: %s",
+				 device->handle->device_index, strerror(errno));
+		device->waiting_for_timer = false;
+	} else if (handle_events(device->handle, &device->evtctx)) {
+		device->update_requested = false;
+	}
+
+	if (!device->removed)
+		loop_request_update(device);
+}
+
+evdi_loop_handle evdi_loop_create(void)
+{
+	evdi_loop_handle loop = calloc(1, sizeof(struct evdi_loop));
+
+	if (!loop)
+		return NULL;
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		evdi_log("Failed to create event loop: %s", strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+void evdi_loop_destroy(evdi_loop_handle loop)
+{
+	if (!loop)
+		return;
+
+	assert(!loop->dispatching);
+
+	while (loop->devices)
+		free_loop_device(loop, loop->devices);
+	close(loop->epoll_fd);
+	free(loop);
+}
+
+int evdi_loop_add(evdi_loop_handle loop,
+		  evdi_handle handle,
+		  const struct evdi_event_context *evtctx,
+		  int buffer_id,
+		  unsigned int target_fps)
+{
+	struct evdi_loop_device *device = NULL;
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	assert(loop);
+	assert(handle);
+	assert(evtctx);
+
+	if (find_loop_device(loop, handle)) {
+		evdi_log("/dev/dri/card%d is already in the event loop",
+			 handle->device_index);
+		errno = EEXIST;
+		return -1;
+	}
+
+	device = calloc(1, sizeof(struct evdi_loop_device));
+	if (!device)
+		return -1;
+
+	device->handle = handle;
+	device->evtctx = *evtctx;
+	device->buffer_id = buffer_id;
+	device->timer_fd = -1;
+	device->device_source.device = device;
+	device->timer_source.device = device;
+	device->timer_source.is_timer = true;
+
+	ev.data.ptr = &device->device_source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, handle->fd, &ev)) {
+		evdi_log("Failed to add /dev/dri/card%d to event loop: %s",
+			 handle->device_index, strerror(errno));
+		free(device);
+		return -1;
+	}
+
+	if (target_fps) {
+		device->frame_interval_ns = NSEC_PER_SEC / target_fps;
+		device->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						  TFD_NONBLOCK | TFD_CLOEXEC);
+		ev.data.ptr = &device->timer_source;
+		if (device->timer_fd < 0 ||
+		    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD,
+			      device->timer_fd, &ev)) {
+			const int err = errno;
+
+			evdi_log("Failed to set up frame pacing for /dev/dri/card%d: %s",
+				 handle->device_index, strerror(err));
+			epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+			if (device->timer_fd >= 0)
+				close(device->timer_fd);
+			free(device);
+			errno = err;
+			return -1;
+		}
+	}
+
+	device->next = loop->devices;
+	loop->devices = device;
+
+	update_event_mask(handle, &device->evtctx);
+
+	loop_request_update(device);
+	return 0;
+}
+
+void evdi_loop_remove(evdi_loop_handle loop, evdi_handle handle)
+{
+	struct evdi_loop_device *device = NULL;
+
+	assert(loop);
+
+	device = find_loop_device(loop, handle);
+	if (device)
+		remove_loop_device(loop, device);
+}
+
+void evdi_loop_set_buffer(evdi_loop_handle loop, evdi_handle handle,
+			  int buffer_id)
+{
+	struct evdi_loop_device *device = NULL;
+
+	assert(loop);
+
+	device = find_loop_device(loop, handle);
+	if (!device)
+		return;
+
+	device->buffer_id = buffer_id;
+	if (buffer_id >= 0 &&
+	    (device->update_requested || device->update_ready))
+		handle->bufferToUpdate = buffer_id;
+	else
+		loop_request_update(device);
+}
+
+evdi_selectable evdi_loop_get_fd(evdi_loop_handle loop)
+{
+	return loop->epoll_fd;
+}
+
+int evdi_loop_dispatch(evdi_loop_handle loop, int timeout_ms)
+{
+	struct epoll_event events[EVDI_LOOP_MAX_EVENTS];
+	struct evdi_loop_device *device = NULL;
+	struct evdi_loop_device *next = NULL;
+	int dispatched = 0;
+	int count = 0;
+
+	assert(loop);
+	assert(!loop->dispatching);
+
+	for (device = loop->devices; device != NULL; device = device->next) {
+		if (device->update_ready) {
+			timeout_ms = 0;
+			break;
+		}
+	}
+
+	count = epoll_wait(loop->epoll_fd, events, EVDI_LOOP_MAX_EVENTS,
+			   timeout_ms);
+	if (count < 0) {
+		if (errno == EINTR)
+			return 0;
+		evdi_log("Event loop wait failed: %s", strerror(errno));
+		return -1;
+	}
+
+	loop->dispatching = true;
+
+	for (int i = 0; i < count; ++i)
+		handle_loop_source(events[i].data.ptr);
+	dispatched = count;
+
+	for (device = loop->devices; device != NULL; device = device->next) {
+		if (device->removed || !device->update_ready)
+			continue;
+
+		device->update_ready = false;
+		device->evtctx.update_ready_handler(
+			device->handle->bufferToUpdate,
+			device->evtctx.user_data);
+		++dispatched;
+
+		if (!device->removed)
+			loop_request_update(device);
+	}
+
+	loop->dispatching = false;
+
+	for (device = loop->devices; device != NULL; device = next) {
+		next = device->next;
+		if (device->removed)
+			free_loop_device(loop, device);
+	}
+
+	return dispatched;
+}
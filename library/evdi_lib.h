@@ -27,6 +27,9 @@ struct evdi_device_context;
 typedef struct evdi_device_context *evdi_handle;
 typedef int evdi_selectable;
 
+struct evdi_loop;
+typedef struct evdi_loop *evdi_loop_handle;
+
 enum evdi_device_status {
 	AVAILABLE,
 	UNRECOGNIZED,
@@ -37,6 +40,12 @@ struct evdi_rect {
 	int x1, y1, x2, y2;
 };
 
+struct evdi_update_summary {
+	int num_rects;
+	struct evdi_rect bounds;
+	uint32_t area;
+};
+
 struct evdi_mode {
 	int width;
 	int height;
@@ -109,6 +118,9 @@ evdi_handle evdi_open_attached_to(const char *sysfs_parent_device);
 evdi_handle evdi_open_attached_to_fixed(const char *sysfs_parent_device, size_t length);
 
 void evdi_close(evdi_handle handle);
+evdi_handle evdi_open_head(evdi_handle handle, int head);
+int evdi_get_head_count(evdi_handle handle);
+int evdi_get_event_head(evdi_handle handle);
 void evdi_connect(evdi_handle handle, const unsigned char *edid,
 		  const unsigned int edid_length,
 		  const uint32_t sku_area_limit);
@@ -122,6 +134,11 @@ void evdi_enable_cursor_events(evdi_handle handle, bool enable);
 void evdi_grab_pixels(evdi_handle handle,
 		      struct evdi_rect *rects,
 		      int *num_rects);
+bool evdi_wait_and_grab(evdi_handle handle,
+			int bufferId,
+			int timeout_ms,
+			struct evdi_rect *rects,
+			int *num_rects);
 void evdi_register_buffer(evdi_handle handle, struct evdi_buffer buffer);
 void evdi_unregister_buffer(evdi_handle handle, int bufferId);
 bool evdi_request_update(evdi_handle handle, int bufferId);
@@ -130,10 +147,26 @@ void evdi_ddcci_response(evdi_handle handle, const unsigned char *buffer,
 		const bool result);
 
 void evdi_handle_events(evdi_handle handle, struct evdi_event_context *evtctx);
+bool evdi_get_update_summary(evdi_handle handle,
+			     struct evdi_update_summary *summary);
 evdi_selectable evdi_get_event_ready(evdi_handle handle);
+int evdi_get_buffer_pitch(evdi_handle handle, int width, int bits_per_pixel);
 void evdi_get_lib_version(struct evdi_lib_version *version);
 void evdi_set_logging(struct evdi_logging evdi_logging);
 
+evdi_loop_handle evdi_loop_create(void);
+void evdi_loop_destroy(evdi_loop_handle loop);
+int evdi_loop_add(evdi_loop_handle loop,
+		  evdi_handle handle,
+		  const struct evdi_event_context *evtctx,
+		  int buffer_id,
+		  unsigned int target_fps);
+void evdi_loop_remove(evdi_loop_handle loop, evdi_handle handle);
+void evdi_loop_set_buffer(evdi_loop_handle loop, evdi_handle handle,
+			  int buffer_id);
+evdi_selectable evdi_loop_get_fd(evdi_loop_handle loop);
+int evdi_loop_dispatch(evdi_loop_handle loop, int timeout_ms);
+
 bool Xorg_running(void);
 
 #ifdef __cplusplus
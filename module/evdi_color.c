@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <drm/drm_fourcc.h>
+#include "evdi_color.h"
+
+#define EVDI_COLOR_MAX 0xffff
+#define EVDI_COLOR_IN_MAX (EVDI_COLOR_LUT_SIZE - 1)
+
+static u16 evdi_color_lut_component(const struct drm_color_lut *entry, int c)
+{
+	switch (c) {
+	case 0:
+		return entry->red;
+	case 1:
+		return entry->green;
+	default:
+		return entry->blue;
+	}
+}
+
+/*
+ * Samples a LUT blob at a 16 bit position, interpolating linearly between
+ * neighbouring entries, so blobs of any size can be used.
+ */
+static u16 evdi_color_lut_sample(const struct drm_color_lut *lut, int size,
+				 int c, u32 in)
+{
+	u64 pos;
+	u32 idx, frac;
+	u32 a, b;
+
+	if (!lut || size <= 0)
+		return in;
+	if (size == 1)
+		return evdi_color_lut_component(&lut[0], c);
+
+	pos = (u64)in * (size - 1);
+	idx = div_u64_rem(pos, EVDI_COLOR_MAX, &frac);
+	a = evdi_color_lut_component(&lut[idx], c);
+	if (idx + 1 >= size)
+		return a;
+	b = evdi_color_lut_component(&lut[idx + 1], c);
+
+	return (a * (EVDI_COLOR_MAX - frac) + b * frac + EVDI_COLOR_MAX / 2) /
+	       EVDI_COLOR_MAX;
+}
+
+static u32 evdi_color_in16(u32 in10)
+{
+	return in10 * EVDI_COLOR_MAX / EVDI_COLOR_IN_MAX;
+}
+
+static u32 evdi_color_out(u32 v16, int bits)
+{
+	const u32 max = (1u << bits) - 1;
+
+	return (v16 * max + EVDI_COLOR_MAX / 2) / EVDI_COLOR_MAX;
+}
+
+/* The CTM property holds S31.32 sign-magnitude values */
+static s32 evdi_color_ctm_coeff(u64 value)
+{
+	const bool negative = value & BIT_ULL(63);
+	const u64 magnitude = (value & ~BIT_ULL(63)) >> 16;
+	const s32 coeff = min_t(u64, magnitude, S32_MAX);
+
+	return negative ? -coeff : coeff;
+}
+
+static bool evdi_color_ctm_is_identity(const s32 *ctm)
+{
+	int i;
+
+	for (i = 0; i < 9; ++i)
+		if (ctm[i] != (i % 4 == 0 ? 1 << 16 : 0))
+			return false;
+	return true;
+}
+
+static bool evdi_color_is_identity(const struct evdi_color *color)
+{
+	int c, i;
+
+	if (color->has_ctm)
+		return false;
+
+	for (c = 0; c < 3; ++c)
+		for (i = 0; i < EVDI_COLOR_LUT_SIZE; ++i)
+			if (color->out10[c][i] != i)
+				return false;
+	return true;
+}
+
+struct evdi_color *evdi_color_create(const struct drm_color_lut *degamma,
+				     int degamma_size,
+				     const struct drm_color_ctm *ctm,
+				     const struct drm_color_lut *gamma,
+				     int gamma_size)
+{
+	struct evdi_color *color;
+	int c, i;
+
+	if (!degamma && !ctm && !gamma)
+		return NULL;
+
+	color = kvzalloc(sizeof(*color), GFP_KERNEL);
+	if (!color)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&color->kref);
+
+	if (ctm) {
+		for (i = 0; i < 9; ++i)
+			color->ctm[i] = evdi_color_ctm_coeff(ctm->matrix[i]);
+		color->has_ctm = !evdi_color_ctm_is_identity(color->ctm);
+	}
+
+	for (c = 0; c < 3; ++c) {
+		for (i = 0; i < EVDI_COLOR_LUT_SIZE; ++i) {
+			const u32 in = evdi_color_in16(i);
+			u32 out;
+
+			color->linear[c][i] = evdi_color_lut_sample(degamma,
+								    degamma_size,
+								    c, in);
+			if (color->has_ctm)
+				out = evdi_color_lut_sample(gamma, gamma_size,
+							    c, in);
+			else
+				out = evdi_color_lut_sample(gamma, gamma_size,
+							    c, color->linear[c][i]);
+
+			color->out5[c][i] = evdi_color_out(out, 5);
+			color->out6[c][i] = evdi_color_out(out, 6);
+			color->out8[c][i] = evdi_color_out(out, 8);
+			color->out10[c][i] = evdi_color_out(out, 10);
+		}
+	}
+
+	if (evdi_color_is_identity(color)) {
+		kvfree(color);
+		return NULL;
+	}
+
+	return color;
+}
+
+static void evdi_color_release(struct kref *kref)
+{
+	kvfree(container_of(kref, struct evdi_color, kref));
+}
+
+struct evdi_color *evdi_color_get(struct evdi_color *color)
+{
+	if (color)
+		kref_get(&color->kref);
+	return color;
+}
+
+void evdi_color_put(struct evdi_color *color)
+{
+	if (color)
+		kref_put(&color->kref, evdi_color_release);
+}
+
+/*
+ * Maps 10 bit components to indices into the output tables, which are the
+ * components themselves unless there is a CTM.
+ */
+static void evdi_color_index(const struct evdi_color *color, u32 *in)
+{
+	s64 linear[3];
+	int c;
+
+	if (!color->has_ctm)
+		return;
+
+	for (c = 0; c < 3; ++c)
+		linear[c] = color->linear[c][in[c]];
+
+	for (c = 0; c < 3; ++c) {
+		const s32 *row = &color->ctm[c * 3];
+		const s64 v = (row[0] * linear[0] + row[1] * linear[1] +
+			       row[2] * linear[2]) >> 16;
+		const u32 v16 = clamp_t(s64, v, 0, EVDI_COLOR_MAX);
+
+		/* Rounds v16 * EVDI_COLOR_IN_MAX / EVDI_COLOR_MAX */
+		in[c] = (v16 * EVDI_COLOR_IN_MAX + BIT(15)) >> 16;
+	}
+}
+
+static u32 evdi_color_expand(u32 v, int bits)
+{
+	return (v << (10 - bits)) | (v >> (2 * bits - 10));
+}
+
+static u32 evdi_color_map_8888(const struct evdi_color *color, u32 pixel,
+			       int r_shift, int b_shift)
+{
+	u32 in[3];
+
+	in[0] = evdi_color_expand((pixel >> r_shift) & 0xff, 8);
+	in[1] = evdi_color_expand((pixel >> 8) & 0xff, 8);
+	in[2] = evdi_color_expand((pixel >> b_shift) & 0xff, 8);
+	evdi_color_index(color, in);
+
+	return (pixel & 0xff000000) |
+	       (u32)color->out8[0][in[0]] << r_shift |
+	       (u32)color->out8[1][in[1]] << 8 |
+	       (u32)color->out8[2][in[2]] << b_shift;
+}
+
+static u16 evdi_color_map_565(const struct evdi_color *color, u16 pixel)
+{
+	u32 in[3];
+
+	in[0] = evdi_color_expand((pixel >> 11) & 0x1f, 5);
+	in[1] = evdi_color_expand((pixel >> 5) & 0x3f, 6);
+	in[2] = evdi_color_expand(pixel & 0x1f, 5);
+	evdi_color_index(color, in);
+
+	return color->out5[0][in[0]] << 11 |
+	       color->out6[1][in[1]] << 5 |
+	       color->out5[2][in[2]];
+}
+
+static u32 evdi_color_map_2101010(const struct evdi_color *color, u32 pixel)
+{
+	u32 in[3];
+
+	in[0] = (pixel >> 20) & 0x3ff;
+	in[1] = (pixel >> 10) & 0x3ff;
+	in[2] = pixel & 0x3ff;
+	evdi_color_index(color, in);
+
+	return (pixel & 0xc0000000) |
+	       (u32)color->out10[0][in[0]] << 20 |
+	       (u32)color->out10[1][in[1]] << 10 |
+	       color->out10[2][in[2]];
+}
+
+/*
+ * Applies color management in place to a row of pixels. YUV formats are
+ * passed to the client untouched.
+ */
+void evdi_color_apply_row(const struct evdi_color *color, uint32_t format,
+			  void *row, int width)
+{
+	u32 *row32 = row;
+	u16 *row16 = row;
+	int x;
+
+	if (!color)
+		return;
+
+	switch (format) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+		for (x = 0; x < width; ++x)
+			row32[x] = evdi_color_map_8888(color, row32[x], 16, 0);
+		break;
+	case DRM_FORMAT_XBGR8888:
+	case DRM_FORMAT_ABGR8888:
+		for (x = 0; x < width; ++x)
+			row32[x] = evdi_color_map_8888(color, row32[x], 0, 16);
+		break;
+	case DRM_FORMAT_RGB565:
+		for (x = 0; x < width; ++x)
+			row16[x] = evdi_color_map_565(color, row16[x]);
+		break;
+	case DRM_FORMAT_XRGB2101010:
+		for (x = 0; x < width; ++x)
+			row32[x] = evdi_color_map_2101010(color, row32[x]);
+		break;
+	default:
+		break;
+	}
+}
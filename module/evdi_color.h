@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-2.0-only
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#ifndef EVDI_COLOR_H
+#define EVDI_COLOR_H
+
+#include <linux/kref.h>
+#include <linux/types.h>
+#include <drm/drm_mode.h>
+
+#define EVDI_COLOR_LUT_SIZE 1024
+
+/*
+ * Color management of a CRTC, applied to pixels copied to a grab buffer.
+ * Components are looked up with 10 bits. Without a CTM the degamma and
+ * gamma LUTs are folded into one table per component, otherwise the
+ * components are linearised, multiplied by the CTM and gamma corrected.
+ * The last lookup gives the output at the depth of the format, so pixels
+ * are mapped without divisions. A NULL pointer stands for the identity,
+ * which skips the tables.
+ */
+struct evdi_color {
+	struct kref kref;
+	bool has_ctm;
+	/* Degamma to 16 bits, only used with a CTM */
+	u16 linear[3][EVDI_COLOR_LUT_SIZE];
+	/* Gamma, or degamma and gamma folded, by output depth */
+	u8 out5[3][EVDI_COLOR_LUT_SIZE];
+	u8 out6[3][EVDI_COLOR_LUT_SIZE];
+	u8 out8[3][EVDI_COLOR_LUT_SIZE];
+	u16 out10[3][EVDI_COLOR_LUT_SIZE];
+	/* S15.16 fixed point, row major */
+	s32 ctm[9];
+};
+
+struct evdi_color *evdi_color_create(const struct drm_color_lut *degamma,
+				     int degamma_size,
+				     const struct drm_color_ctm *ctm,
+				     const struct drm_color_lut *gamma,
+				     int gamma_size);
+struct evdi_color *evdi_color_get(struct evdi_color *color);
+void evdi_color_put(struct evdi_color *color);
+
+void evdi_color_apply_row(const struct evdi_color *color, uint32_t format,
+			  void *row, int width);
+
+#endif /* EVDI_COLOR_H */
@@ -27,13 +27,29 @@
  * all EVDI appear to have a DVI-D
  */
 
-static int evdi_get_modes(struct drm_connector *connector)
+static struct evdi_head *evdi_connector_head(struct drm_connector *connector)
 {
 	struct evdi_device *evdi = connector->dev->dev_private;
+	unsigned int i;
+
+	for (i = 0; i < evdi->num_heads; ++i)
+		if (evdi->heads[i].conn == connector)
+			return &evdi->heads[i];
+
+	return &evdi->heads[0];
+}
+
+static int evdi_get_modes(struct drm_connector *connector)
+{
+	struct evdi_head *head = evdi_connector_head(connector);
+	struct evdi_device *evdi = head->evdi;
 	struct edid *edid = NULL;
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+	unsigned int min_hz, max_hz;
+#endif
 	int ret = 0;
 
-	edid = (struct edid *)evdi_painter_get_edid_copy(evdi);
+	edid = (struct edid *)evdi_painter_get_edid_copy(head);
 
 	if (!edid) {
 #if KERNEL_VERSION(4, 19, 0) <= LINUX_VERSION_CODE || defined(EL8)
@@ -56,12 +72,35 @@ static int evdi_get_modes(struct drm_connector *connector)
 	}
 
 	ret = drm_add_edid_modes(connector, edid);
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+	drm_connector_set_vrr_capable_property(connector,
+		evdi_connector_vrr_range(head, &min_hz, &max_hz));
+#endif
 	EVDI_INFO("(card%d) Edid property set\n", evdi->dev_index);
 err:
 	kfree(edid);
 	return ret;
 }
 
+/*
+ * The refresh range set for the device, or else the one of the EDID.
+ * Returns whether it is wide enough for variable refresh.
+ */
+bool evdi_connector_vrr_range(struct evdi_head *head,
+			      unsigned int *min_hz, unsigned int *max_hz)
+{
+	*min_hz = READ_ONCE(head->evdi->vrr_min_hz);
+	*max_hz = READ_ONCE(head->evdi->vrr_max_hz);
+#if KERNEL_VERSION(5, 6, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	if (!*max_hz && head->conn) {
+		*min_hz = head->conn->display_info.monitor_range.min_vfreq;
+		*max_hz = head->conn->display_info.monitor_range.max_vfreq;
+	}
+#endif
+
+	return *min_hz && *max_hz > *min_hz + 10;
+}
+
 static bool is_lowest_frequency_mode_of_given_resolution(
 	struct drm_connector *connector, const struct drm_display_mode *mode)
 {
@@ -84,14 +123,15 @@ static enum drm_mode_status evdi_mode_valid(struct drm_connector *connector,
 					    struct drm_display_mode *mode)
 #endif
 {
-	struct evdi_device *evdi = connector->dev->dev_private;
+	struct evdi_head *head = evdi_connector_head(connector);
+	struct evdi_device *evdi = head->evdi;
 	uint32_t area_limit = mode->hdisplay * mode->vdisplay;
 	uint32_t mode_limit = area_limit * drm_mode_vrefresh(mode);
 
-	if (evdi->pixel_per_second_limit == 0)
+	if (head->pixel_per_second_limit == 0)
 		return MODE_OK;
 
-	if (area_limit > evdi->pixel_area_limit) {
+	if (area_limit > head->pixel_area_limit) {
 		EVDI_WARN(
 			"(card%d) Mode %dx%d@%d rejected. Reason: mode area too big\n",
 			evdi->dev_index,
@@ -101,7 +141,7 @@ static enum drm_mode_status evdi_mode_valid(struct drm_connector *connector,
 		return MODE_BAD;
 	}
 
-	if (mode_limit <= evdi->pixel_per_second_limit)
+	if (mode_limit <= head->pixel_per_second_limit)
 		return MODE_OK;
 
 	if (is_lowest_frequency_mode_of_given_resolution(connector, mode)) {
@@ -127,16 +167,17 @@ static enum drm_mode_status evdi_mode_valid(struct drm_connector *connector,
 static enum drm_connector_status
 evdi_detect(struct drm_connector *connector, __always_unused bool force)
 {
-	struct evdi_device *evdi = connector->dev->dev_private;
+	struct evdi_head *head = evdi_connector_head(connector);
+	struct evdi_device *evdi = head->evdi;
 
 	EVDI_CHECKPT();
-	if (evdi_painter_is_connected(evdi->painter)) {
-		EVDI_INFO("(card%d) Connector state: connected\n",
-			   evdi->dev_index);
+	if (evdi_painter_is_connected(head->painter)) {
+		EVDI_INFO("(card%d) Connector %u state: connected\n",
+			   evdi->dev_index, head->index);
 		return connector_status_connected;
 	}
-	EVDI_VERBOSE("(card%d) Connector state: disconnected\n",
-		   evdi->dev_index);
+	EVDI_VERBOSE("(card%d) Connector %u state: disconnected\n",
+		   evdi->dev_index, head->index);
 	return connector_status_disconnected;
 }
 
@@ -179,10 +220,10 @@ static const struct drm_connector_funcs evdi_connector_funcs = {
 	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state
 };
 
-int evdi_connector_init(struct drm_device *dev, struct drm_encoder *encoder)
+int evdi_connector_init(struct drm_device *dev, struct drm_encoder *encoder,
+			struct evdi_head *head)
 {
 	struct drm_connector *connector;
-	struct evdi_device *evdi = dev->dev_private;
 
 	connector = kzalloc(sizeof(struct drm_connector), GFP_KERNEL);
 	if (!connector)
@@ -193,10 +234,13 @@ int evdi_connector_init(struct drm_device *dev, struct drm_encoder *encoder)
 			   DRM_MODE_CONNECTOR_DVII);
 	drm_connector_helper_add(connector, &evdi_connector_helper_funcs);
 	connector->polled = DRM_CONNECTOR_POLL_HPD;
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+	drm_connector_attach_vrr_capable_property(connector);
+#endif
 
-	drm_connector_register(connector);
+	head->conn = connector;
 
-	evdi->conn = connector;
+	drm_connector_register(connector);
 
 #if KERNEL_VERSION(4, 19, 0) <= LINUX_VERSION_CODE  || defined(EL8)
 	drm_connector_attach_encoder(connector, encoder);
@@ -31,6 +31,7 @@
 
 #include "evdi_cursor.h"
 #include "evdi_drm_drv.h"
+#include "evdi_color.h"
 
 /*
  * EVDI drm cursor private structure.
@@ -174,20 +175,167 @@ static inline uint32_t blend_alpha(const uint32_t pixel_val32,
 				(blend_val32 & 0xff0000) >> 16, alpha) << 16;
 }
 
-static int evdi_cursor_compose_pixel(char __user *buffer,
-				     int const cursor_value,
-				     int const fb_value,
-				     int cmd_offset)
+/*
+ * Pixel under the cursor at x, y on the CRTC, from the topmost overlay
+ * covering it if any, otherwise at fb_x, fb_y of the primary plane.
+ */
+static uint32_t evdi_cursor_underlying_pixel(struct evdi_framebuffer *efb,
+					     const struct evdi_overlay *overlays,
+					     int num_overlays, int x, int y,
+					     int fb_x, int fb_y)
 {
-	int const composed_value = blend_alpha(fb_value, cursor_value);
+	struct drm_framebuffer *fb = &efb->base;
+	const uint32_t *row;
+	int i;
+
+	for (i = num_overlays - 1; i >= 0; --i) {
+		const struct evdi_overlay *overlay = &overlays[i];
+		struct drm_framebuffer *ofb;
+
+		if (!overlay->efb ||
+		    x < overlay->dst.x1 || x >= overlay->dst.x2 ||
+		    y < overlay->dst.y1 || y >= overlay->dst.y2)
+			continue;
+
+		ofb = &overlay->efb->base;
+		row = overlay->efb->obj->vmapping + ofb->offsets[0] +
+		      ofb->pitches[0] * (overlay->src_y + y - overlay->dst.y1);
+		return evdi_fb_convert_pixel(
+			le32_to_cpu(row[overlay->src_x + x - overlay->dst.x1]),
+			ofb->format->format, fb->format->format);
+	}
 
-	return copy_to_user(buffer + cmd_offset, &composed_value, 4);
+	row = efb->obj->vmapping + fb->offsets[0] + fb->pitches[0] * fb_y;
+	return row[fb_x];
+}
+
+static inline uint32_t blend_component_10(uint32_t pixel,
+					  uint32_t blend,
+					  uint32_t alpha)
+{
+	return (pixel * (255 - alpha) + ((blend << 2) | (blend >> 6)) * alpha +
+		127) / 255;
+}
+
+static uint16_t compose_rgb565(uint16_t pixel, uint32_t cursor_value)
+{
+	const uint32_t r = (pixel >> 11) & 0x1f;
+	const uint32_t g = (pixel >> 5) & 0x3f;
+	const uint32_t b = pixel & 0x1f;
+	const uint32_t composed = blend_alpha(((r << 3) | (r >> 2)) << 16 |
+					      ((g << 2) | (g >> 4)) << 8 |
+					      ((b << 3) | (b >> 2)),
+					      cursor_value);
+
+	return (composed >> 8 & 0xf800) | (composed >> 5 & 0x07e0) |
+	       (composed >> 3 & 0x001f);
+}
+
+static uint32_t compose_xrgb2101010(uint32_t pixel, uint32_t cursor_value)
+{
+	const uint32_t alpha = cursor_value >> 24;
+
+	return blend_component_10(pixel >> 20 & 0x3ff,
+				  cursor_value >> 16 & 0xff, alpha) << 20 |
+	       blend_component_10(pixel >> 10 & 0x3ff,
+				  cursor_value >> 8 & 0xff, alpha) << 10 |
+	       blend_component_10(pixel & 0x3ff, cursor_value & 0xff, alpha);
+}
+
+/*
+ * Blends the cursor into the limited range BT.601 luma of the pixel and,
+ * for the top left pixel of each 2x2 block, into the chroma of the block.
+ */
+static int compose_nv12(struct evdi_framebuffer *efb,
+			const struct evdi_pixel_dst *dst,
+			uint32_t cursor_value, int x, int y)
+{
+	struct drm_framebuffer *fb = &efb->base;
+	const uint8_t *src = efb->obj->vmapping;
+	const uint32_t alpha = cursor_value >> 24;
+	const int r = cursor_value >> 16 & 0xff;
+	const int g = cursor_value >> 8 & 0xff;
+	const int b = cursor_value & 0xff;
+	const uint8_t luma = blend_component(
+		src[fb->offsets[0] + fb->pitches[0] * y + x],
+		16 + ((66 * r + 129 * g + 25 * b + 128) >> 8), alpha);
+	uint8_t chroma[2];
+	const uint8_t *uv;
+
+	if (evdi_pixel_dst_write(dst, (long)dst->stride * y + x, &luma, 1))
+		return -EFAULT;
+
+	if ((x | y) & 1)
+		return 0;
+
+	uv = src + fb->offsets[1] + fb->pitches[1] * (y / 2) + x;
+	chroma[0] = blend_component(uv[0],
+				    128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8),
+				    alpha);
+	chroma[1] = blend_component(uv[1],
+				    128 + ((112 * r - 94 * g - 18 * b + 128) >> 8),
+				    alpha);
+	return evdi_pixel_dst_write(dst,
+				    (long)dst->stride * (fb->height + y / 2) + x,
+				    chroma, 2);
+}
+
+/*
+ * Writes a pixel of the cursor at x, y on the CRTC, blended in the format
+ * of the framebuffer with the pixel the rotation shows there. The blended
+ * pixel passes through color management of the CRTC like the planes.
+ */
+static int evdi_cursor_compose_pixel(struct evdi_framebuffer *efb,
+				     unsigned int rotation,
+				     const struct evdi_color *color,
+				     const struct evdi_overlay *overlays,
+				     int num_overlays,
+				     const struct evdi_pixel_dst *dst,
+				     uint32_t cursor_value, int x, int y)
+{
+	struct drm_framebuffer *fb = &efb->base;
+	const long dst_offset = (long)dst->stride * y;
+	int fb_x = x, fb_y = y;
+	const char *row;
+	uint16_t value16;
+	uint32_t value32;
+
+	evdi_fb_unrotate_point(fb, rotation, &fb_x, &fb_y);
+	row = (const char *)efb->obj->vmapping + fb->offsets[0] +
+	      fb->pitches[0] * fb_y;
+
+	switch (fb->format->format) {
+	case DRM_FORMAT_RGB565:
+		value16 = compose_rgb565(((const uint16_t *)row)[fb_x],
+					 cursor_value);
+		evdi_color_apply_row(color, fb->format->format, &value16, 1);
+		return evdi_pixel_dst_write(dst, dst_offset + x * 2, &value16, 2);
+	case DRM_FORMAT_XRGB2101010:
+		value32 = compose_xrgb2101010(((const uint32_t *)row)[fb_x],
+					      cursor_value);
+		evdi_color_apply_row(color, fb->format->format, &value32, 1);
+		return evdi_pixel_dst_write(dst, dst_offset + x * 4, &value32, 4);
+	case DRM_FORMAT_NV12:
+		return compose_nv12(efb, dst, cursor_value, x, y);
+	default:
+		value32 = blend_alpha(
+			evdi_cursor_underlying_pixel(efb, overlays,
+						     num_overlays, x, y,
+						     fb_x, fb_y),
+			evdi_fb_convert_pixel(cursor_value, DRM_FORMAT_ARGB8888,
+					      fb->format->format));
+		evdi_color_apply_row(color, fb->format->format, &value32, 1);
+		return evdi_pixel_dst_write(dst, dst_offset + x * 4, &value32, 4);
+	}
 }
 
 int evdi_cursor_compose_and_copy(struct evdi_cursor *cursor,
 				 struct evdi_framebuffer *efb,
-				 char __user *buffer,
-				 int buf_byte_stride)
+				 unsigned int rotation,
+				 const struct evdi_color *color,
+				 const struct evdi_overlay *overlays,
+				 int num_overlays,
+				 const struct evdi_pixel_dst *dst)
 {
 	int x, y;
 	struct drm_framebuffer *fb = &efb->base;
@@ -195,6 +343,7 @@ int evdi_cursor_compose_and_copy(struct evdi_cursor *cursor,
 	const int h_cursor_h = cursor->height >> 1;
 	uint32_t *cursor_buffer = NULL;
 	uint32_t bytespp = 0;
+	int width, height;
 
 	if (!cursor->enabled)
 		return 0;
@@ -219,37 +368,37 @@ int evdi_cursor_compose_and_copy(struct evdi_cursor *cursor,
 	}
 
 	cursor_buffer = (uint32_t *)cursor->obj->vmapping;
+	evdi_fb_rotated_size(fb, rotation, &width, &height);
 
 	for (y = -h_cursor_h; y < h_cursor_h; ++y) {
 		for (x = -h_cursor_w; x < h_cursor_w; ++x) {
 			uint32_t curs_val;
-			int *fbsrc;
-			int fb_value;
-			int cmd_offset;
 			int cursor_pix;
 			int const mouse_pix_x = cursor->x + x + h_cursor_w;
 			int const mouse_pix_y = cursor->y + y + h_cursor_h;
 			bool const is_pix_sane =
 				mouse_pix_x >= 0 &&
 				mouse_pix_y >= 0 &&
-				mouse_pix_x < (int)fb->width &&
-				mouse_pix_y < (int)fb->height;
+				mouse_pix_x < width &&
+				mouse_pix_y < height;
 
 			if (!is_pix_sane)
 				continue;
 
 			cursor_pix = h_cursor_w+x +
 				    (h_cursor_h+y)*cursor->width;
-			curs_val = le32_to_cpu(cursor_buffer[cursor_pix]);
-			fbsrc = (int *)(efb->obj->vmapping + fb->offsets[0]);
-			fb_value = *(fbsrc + ((fb->pitches[0]>>2) *
-						  mouse_pix_y + mouse_pix_x));
-			cmd_offset = (buf_byte_stride * mouse_pix_y) +
-						       (mouse_pix_x * bytespp);
-			if (evdi_cursor_compose_pixel(buffer,
+			curs_val = evdi_fb_convert_pixel(
+				le32_to_cpu(cursor_buffer[cursor_pix]),
+				cursor->pixel_format, DRM_FORMAT_ARGB8888);
+			if (evdi_cursor_compose_pixel(efb,
+						      rotation,
+						      color,
+						      overlays,
+						      num_overlays,
+						      dst,
 						      curs_val,
-						      fb_value,
-						      cmd_offset)) {
+						      mouse_pix_x,
+						      mouse_pix_y)) {
 				EVDI_ERROR("Failed to compose cursor pixel\n");
 				return -EFAULT;
 			}
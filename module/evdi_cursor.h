@@ -29,9 +29,12 @@
 #endif
 #include <drm/drm_crtc.h>
 
+struct evdi_color;
 struct evdi_cursor;
 struct evdi_framebuffer;
 struct evdi_gem_object;
+struct evdi_overlay;
+struct evdi_pixel_dst;
 
 int evdi_cursor_init(struct evdi_cursor **cursor);
 void evdi_cursor_free(struct evdi_cursor *cursor);
@@ -57,6 +60,9 @@ struct evdi_gem_object *evdi_cursor_gem(struct evdi_cursor *cursor);
 
 int evdi_cursor_compose_and_copy(struct evdi_cursor *cursor,
 				 struct evdi_framebuffer *efb,
-				 char __user *buffer,
-				 int buf_byte_stride);
+				 unsigned int rotation,
+				 const struct evdi_color *color,
+				 const struct evdi_overlay *overlays,
+				 int num_overlays,
+				 const struct evdi_pixel_dst *dst);
 #endif
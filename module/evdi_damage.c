@@ -0,0 +1,257 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#include <linux/bitmap.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include "evdi_damage.h"
+#include "evdi_debug.h"
+
+void evdi_damage_expand_rect(struct drm_clip_rect *a,
+			     const struct drm_clip_rect *b)
+{
+	a->x1 = min(a->x1, b->x1);
+	a->y1 = min(a->y1, b->y1);
+	a->x2 = max(a->x2, b->x2);
+	a->y2 = max(a->y2, b->y2);
+}
+
+int evdi_damage_rect_area(const struct drm_clip_rect *r)
+{
+	return (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+void evdi_damage_merge_rects(struct drm_clip_rect *rects, int *count)
+{
+	int a, b;
+
+	for (a = 0; a < *count - 1; ++a) {
+		for (b = a + 1; b < *count;) {
+			/* collapse to bounding rect if it is fewer pixels */
+			const int area_a = evdi_damage_rect_area(&rects[a]);
+			const int area_b = evdi_damage_rect_area(&rects[b]);
+			struct drm_clip_rect bounding_rect = rects[a];
+
+			evdi_damage_expand_rect(&bounding_rect, &rects[b]);
+
+			if (evdi_damage_rect_area(&bounding_rect) <= area_a + area_b) {
+				rects[a] = bounding_rect;
+				rects[b] = rects[*count - 1];
+				/* repass */
+				b = a + 1;
+				--*count;
+			} else {
+				++b;
+			}
+		}
+	}
+}
+
+void evdi_damage_collapse_rects(struct drm_clip_rect *rects, int *count)
+{
+	int i;
+
+	EVDI_VERBOSE("Not enough space for rects. They will be collapsed");
+
+	for (i = 1; i < *count; ++i)
+		evdi_damage_expand_rect(&rects[0], &rects[i]);
+
+	*count = 1;
+}
+
+void evdi_damage_init(struct evdi_damage *damage)
+{
+	memset(damage, 0, sizeof(*damage));
+}
+
+void evdi_damage_set_size(struct evdi_damage *damage,
+			  unsigned int width, unsigned int height)
+{
+	atomic_set(&damage->width,
+		   min_t(unsigned int, width,
+			 EVDI_DAMAGE_TILES_X << EVDI_DAMAGE_TILE_SHIFT));
+	atomic_set(&damage->height,
+		   min_t(unsigned int, height,
+			 EVDI_DAMAGE_TILES_Y << EVDI_DAMAGE_TILE_SHIFT));
+}
+
+struct drm_clip_rect evdi_damage_size(const struct evdi_damage *damage)
+{
+	struct drm_clip_rect rect = {
+		0, 0, atomic_read(&damage->width), atomic_read(&damage->height)
+	};
+
+	return rect;
+}
+
+static void evdi_damage_set_tiles(atomic_long_t *row,
+				  unsigned int first, unsigned int last)
+{
+	unsigned int w;
+
+	for (w = first / BITS_PER_LONG; w <= last / BITS_PER_LONG; ++w) {
+		unsigned long mask = ~0UL;
+
+		if (w == first / BITS_PER_LONG)
+			mask &= BITMAP_FIRST_WORD_MASK(first);
+		if (w == last / BITS_PER_LONG)
+			mask &= BITMAP_LAST_WORD_MASK(last + 1);
+
+		/* Avoid dirtying the cache line when the tiles are already set */
+		if ((atomic_long_read(&row[w]) & mask) != mask)
+			atomic_long_or(mask, &row[w]);
+	}
+}
+
+/*
+ * Safe to call concurrently with itself and with evdi_damage_take.
+ * Returns false when there is no scanout size to clip against.
+ */
+bool evdi_damage_add(struct evdi_damage *damage,
+		     const struct drm_clip_rect *rect)
+{
+	const unsigned int width = atomic_read(&damage->width);
+	const unsigned int height = atomic_read(&damage->height);
+	unsigned int x1, y1, x2, y2, ty;
+
+	if (!width || !height)
+		return false;
+
+	x1 = min_t(unsigned int, min(rect->x1, rect->x2), width);
+	x2 = min_t(unsigned int, max(rect->x1, rect->x2), width);
+	y1 = min_t(unsigned int, min(rect->y1, rect->y2), height);
+	y2 = min_t(unsigned int, max(rect->y1, rect->y2), height);
+
+	if (x1 < x2 && y1 < y2) {
+		const unsigned int first_row = y1 >> EVDI_DAMAGE_TILE_SHIFT;
+		const unsigned int last_row = (y2 - 1) >> EVDI_DAMAGE_TILE_SHIFT;
+
+		for (ty = first_row; ty <= last_row; ++ty)
+			evdi_damage_set_tiles(damage->tiles[ty],
+					      x1 >> EVDI_DAMAGE_TILE_SHIFT,
+					      (x2 - 1) >> EVDI_DAMAGE_TILE_SHIFT);
+
+		/* Tiles must be visible before the row is seen as dirty */
+		smp_mb__before_atomic();
+		for (ty = first_row; ty <= last_row; ++ty) {
+			if (!test_bit(ty, damage->rows))
+				set_bit(ty, damage->rows);
+		}
+	}
+
+	smp_mb__before_atomic();
+	atomic_inc(&damage->pending);
+	return true;
+}
+
+/*
+ * Number of times damage was added since the last take. Non-zero does not
+ * guarantee the next take returns rects, e.g. for damage outside the scanout.
+ */
+int evdi_damage_pending(const struct evdi_damage *damage)
+{
+	return atomic_read(&damage->pending);
+}
+
+static void evdi_damage_add_run(struct drm_clip_rect *rects, int *count,
+				const struct drm_clip_rect *run)
+{
+	int i;
+
+	/* Extend a rect from the row above if it spans the same tiles */
+	for (i = *count - 1; i >= 0; --i) {
+		if (rects[i].x1 == run->x1 && rects[i].x2 == run->x2 &&
+		    rects[i].y2 == run->y1) {
+			rects[i].y2 = run->y2;
+			return;
+		}
+	}
+
+	if (*count == EVDI_DAMAGE_MAX_RECTS)
+		evdi_damage_merge_rects(rects, count);
+
+	if (*count == EVDI_DAMAGE_MAX_RECTS)
+		evdi_damage_expand_rect(&rects[*count - 1], run);
+	else
+		rects[(*count)++] = *run;
+}
+
+static int evdi_damage_collect(struct evdi_damage *damage,
+			       struct drm_clip_rect *rects, int max_rects,
+			       bool clear)
+{
+	const unsigned int width = atomic_read(&damage->width);
+	const unsigned int height = atomic_read(&damage->height);
+	struct drm_clip_rect found[EVDI_DAMAGE_MAX_RECTS];
+	unsigned long rows[BITS_TO_LONGS(EVDI_DAMAGE_TILES_Y)];
+	unsigned long tiles[EVDI_DAMAGE_ROW_LONGS];
+	unsigned int i, ty, tx, end;
+	int count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(rows); ++i)
+		rows[i] = clear ? xchg(&damage->rows[i], 0) :
+				  READ_ONCE(damage->rows[i]);
+
+	for_each_set_bit(ty, rows, EVDI_DAMAGE_TILES_Y) {
+		for (i = 0; i < EVDI_DAMAGE_ROW_LONGS; ++i)
+			tiles[i] = clear ?
+				atomic_long_xchg(&damage->tiles[ty][i], 0) :
+				atomic_long_read(&damage->tiles[ty][i]);
+
+		tx = find_first_bit(tiles, EVDI_DAMAGE_TILES_X);
+		while (tx < EVDI_DAMAGE_TILES_X) {
+			struct drm_clip_rect run;
+
+			end = find_next_zero_bit(tiles, EVDI_DAMAGE_TILES_X, tx);
+
+			run.x1 = tx << EVDI_DAMAGE_TILE_SHIFT;
+			run.y1 = ty << EVDI_DAMAGE_TILE_SHIFT;
+			run.x2 = min(end << EVDI_DAMAGE_TILE_SHIFT, width);
+			run.y2 = min((ty + 1) << EVDI_DAMAGE_TILE_SHIFT, height);
+			if (run.x1 < run.x2 && run.y1 < run.y2)
+				evdi_damage_add_run(found, &count, &run);
+
+			tx = find_next_bit(tiles, EVDI_DAMAGE_TILES_X, end);
+		}
+	}
+
+	evdi_damage_merge_rects(found, &count);
+	if (count > max_rects)
+		evdi_damage_collapse_rects(found, &count);
+
+	memcpy(rects, found, count * sizeof(found[0]));
+	return count;
+}
+
+/*
+ * Returns the accumulated damage as at most max_rects rects without
+ * consuming it.
+ */
+int evdi_damage_peek(struct evdi_damage *damage,
+		     struct drm_clip_rect *rects, int max_rects)
+{
+	if (!atomic_read(&damage->pending))
+		return 0;
+
+	return evdi_damage_collect(damage, rects, max_rects, false);
+}
+
+/*
+ * Swaps the accumulated damage out and returns it as at most max_rects
+ * rects. Damage added concurrently is either returned or kept for the
+ * next take, never lost.
+ */
+int evdi_damage_take(struct evdi_damage *damage,
+		     struct drm_clip_rect *rects, int max_rects)
+{
+	if (!atomic_xchg(&damage->pending, 0))
+		return 0;
+
+	return evdi_damage_collect(damage, rects, max_rects, true);
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0-only
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#ifndef EVDI_DAMAGE_H
+#define EVDI_DAMAGE_H
+
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/types.h>
+#include <drm/drm.h>
+
+/*
+ * Damage is accumulated as a bitmap of 32x32 pixel tiles, big enough for
+ * the largest supported mode (7680x4320). Adding damage only sets bits with
+ * atomic operations, so the commit path never waits for a grab in progress.
+ */
+#define EVDI_DAMAGE_TILE_SHIFT 5
+#define EVDI_DAMAGE_TILES_X 256
+#define EVDI_DAMAGE_TILES_Y 136
+#define EVDI_DAMAGE_ROW_LONGS BITS_TO_LONGS(EVDI_DAMAGE_TILES_X)
+#define EVDI_DAMAGE_MAX_RECTS 16
+
+struct evdi_damage {
+	atomic_t width;
+	atomic_t height;
+	atomic_t pending;
+	unsigned long rows[BITS_TO_LONGS(EVDI_DAMAGE_TILES_Y)];
+	atomic_long_t tiles[EVDI_DAMAGE_TILES_Y][EVDI_DAMAGE_ROW_LONGS];
+};
+
+void evdi_damage_init(struct evdi_damage *damage);
+void evdi_damage_set_size(struct evdi_damage *damage,
+			  unsigned int width, unsigned int height);
+struct drm_clip_rect evdi_damage_size(const struct evdi_damage *damage);
+bool evdi_damage_add(struct evdi_damage *damage,
+		     const struct drm_clip_rect *rect);
+int evdi_damage_pending(const struct evdi_damage *damage);
+int evdi_damage_peek(struct evdi_damage *damage,
+		     struct drm_clip_rect *rects, int max_rects);
+int evdi_damage_take(struct evdi_damage *damage,
+		     struct drm_clip_rect *rects, int max_rects);
+
+void evdi_damage_merge_rects(struct drm_clip_rect *rects, int *count);
+void evdi_damage_collapse_rects(struct drm_clip_rect *rects, int *count);
+int evdi_damage_rect_area(const struct drm_clip_rect *r);
+void evdi_damage_expand_rect(struct drm_clip_rect *a,
+			     const struct drm_clip_rect *b);
+
+#endif /* EVDI_DAMAGE_H */
@@ -26,13 +26,30 @@
 #define DRM_EVDI_EVENT_CURSOR_MOVE   0x80000005
 #define DRM_EVDI_EVENT_DDCCI_DATA    0x80000006
 
+/* Bit of an event type in drm_evdi_set_event_mask.mask */
+#define EVDI_EVENT_MASK_BIT(type) \
+	(1U << ((type) - DRM_EVDI_EVENT_UPDATE_READY))
+#define EVDI_EVENT_MASK_ALL 0xffffffffU
+
+/*
+ * Devices may drive several heads. Every ioctl names the head it acts on and
+ * every event the head it comes from. Both go last in their structs, so
+ * clients built before heads existed act on, and hear from, head 0 only.
+ */
+
 struct drm_evdi_event_update_ready {
 	struct drm_event base;
+	/* Damage pending at the time the event was sent */
+	int32_t num_rects;
+	struct drm_clip_rect bounds;
+	uint32_t area;
+	int32_t head;
 };
 
 struct drm_evdi_event_dpms {
 	struct drm_event base;
 	int32_t mode;
+	int32_t head;
 };
 
 struct drm_evdi_event_mode_changed {
@@ -42,11 +59,13 @@ struct drm_evdi_event_mode_changed {
 	int32_t vrefresh;
 	int32_t bits_per_pixel;
 	uint32_t pixel_format;
+	int32_t head;
 };
 
 struct drm_evdi_event_crtc_state {
 	struct drm_event base;
 	int32_t state;
+	int32_t head;
 };
 
 struct drm_evdi_connect {
@@ -56,10 +75,12 @@ struct drm_evdi_connect {
 	uint32_t edid_length;
 	uint32_t pixel_area_limit;
 	uint32_t pixel_per_second_limit;
+	int32_t head;
 };
 
 struct drm_evdi_request_update {
 	int32_t reserved;
+	int32_t head;
 };
 
 enum drm_evdi_grabpix_mode {
@@ -75,6 +96,19 @@ struct drm_evdi_grabpix {
 	unsigned char __user *buffer;
 	int32_t num_rects;
 	struct drm_clip_rect __user *rects;
+	int32_t head;
+};
+
+struct drm_evdi_wait_and_grab {
+	enum drm_evdi_grabpix_mode mode;
+	int32_t buf_width;
+	int32_t buf_height;
+	int32_t buf_byte_stride;
+	unsigned char __user *buffer;
+	int32_t num_rects;
+	struct drm_clip_rect __user *rects;
+	int32_t timeout_ms;
+	int32_t head;
 };
 
 struct drm_evdi_event_cursor_set {
@@ -88,23 +122,32 @@ struct drm_evdi_event_cursor_set {
 	uint32_t buffer_length;
 	uint32_t pixel_format;
 	uint32_t stride;
+	int32_t head;
 };
 
 struct drm_evdi_event_cursor_move {
 	struct drm_event base;
 	int32_t x;
 	int32_t y;
+	int32_t head;
 };
 
 struct drm_evdi_ddcci_response {
 	const unsigned char * __user buffer;
 	uint32_t buffer_length;
 	uint8_t result;
+	int32_t head;
 };
 
 struct drm_evdi_enable_cursor_events {
 	struct drm_event base;
 	uint8_t enable;
+	int32_t head;
+};
+
+struct drm_evdi_set_event_mask {
+	uint32_t mask;
+	int32_t head;
 };
 
 #define DDCCI_BUFFER_SIZE 64
@@ -115,6 +158,7 @@ struct drm_evdi_event_ddcci_data {
 	uint32_t buffer_length;
 	uint16_t flags;
 	uint16_t address;
+	int32_t head;
 };
 
 /* Input ioctls from evdi lib to driver */
@@ -123,6 +167,8 @@ struct drm_evdi_event_ddcci_data {
 #define DRM_EVDI_GRABPIX          0x02
 #define DRM_EVDI_DDCCI_RESPONSE   0x03
 #define DRM_EVDI_ENABLE_CURSOR_EVENTS 0x04
+#define DRM_EVDI_SET_EVENT_MASK   0x05
+#define DRM_EVDI_WAIT_AND_GRAB    0x06
 /* LAST_IOCTL 0x5F -- 96 driver specific ioctls to use */
 
 #define DRM_IOCTL_EVDI_CONNECT DRM_IOWR(DRM_COMMAND_BASE +  \
@@ -135,5 +181,9 @@ struct drm_evdi_event_ddcci_data {
 	DRM_EVDI_DDCCI_RESPONSE, struct drm_evdi_ddcci_response)
 #define DRM_IOCTL_EVDI_ENABLE_CURSOR_EVENTS DRM_IOWR(DRM_COMMAND_BASE +  \
 	DRM_EVDI_ENABLE_CURSOR_EVENTS, struct drm_evdi_enable_cursor_events)
+#define DRM_IOCTL_EVDI_SET_EVENT_MASK DRM_IOWR(DRM_COMMAND_BASE +  \
+	DRM_EVDI_SET_EVENT_MASK, struct drm_evdi_set_event_mask)
+#define DRM_IOCTL_EVDI_WAIT_AND_GRAB DRM_IOWR(DRM_COMMAND_BASE +  \
+	DRM_EVDI_WAIT_AND_GRAB, struct drm_evdi_wait_and_grab)
 
 #endif /* __EVDI_UAPI_DRM_H__ */
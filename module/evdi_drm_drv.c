@@ -28,11 +28,16 @@
 #include <drm/drm_managed.h>
 #endif
 #include <drm/drm_atomic_helper.h>
+#include <linux/debugfs.h>
+#include <linux/workqueue.h>
+#include <linux/nodemask.h>
+#include <linux/seq_file.h>
 #include "evdi_drm_drv.h"
 #include "evdi_platform_drv.h"
 #include "evdi_cursor.h"
 #include "evdi_debug.h"
 #include "evdi_drm.h"
+#include "evdi_params.h"
 
 #if KERNEL_VERSION(6, 8, 0) <= LINUX_VERSION_CODE || defined(EL9)
 #define EVDI_DRM_UNLOCKED 0
@@ -48,6 +53,8 @@ struct drm_ioctl_desc evdi_painter_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(EVDI_GRABPIX, evdi_painter_grabpix_ioctl, EVDI_DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(EVDI_DDCCI_RESPONSE, evdi_painter_ddcci_response_ioctl, EVDI_DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(EVDI_ENABLE_CURSOR_EVENTS, evdi_painter_enable_cursor_events_ioctl, EVDI_DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(EVDI_SET_EVENT_MASK, evdi_painter_set_event_mask_ioctl, EVDI_DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(EVDI_WAIT_AND_GRAB, evdi_painter_wait_and_grab_ioctl, EVDI_DRM_UNLOCKED),
 };
 
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(EL8)
@@ -117,6 +124,10 @@ static struct drm_driver driver = {
 #else
 	.gem_free_object = evdi_gem_free_object,
 #endif
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(EL8)
+#else
+	.gem_close_object = evdi_gem_close_object,
+#endif
 
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(EL8)
 #else
@@ -135,7 +146,7 @@ static struct drm_driver driver = {
 
 	.fops = &evdi_driver_fops,
 
-	.gem_prime_import = drm_gem_prime_import,
+	.gem_prime_import = evdi_gem_prime_import,
 #if KERNEL_VERSION(6, 6, 0) <= LINUX_VERSION_CODE || defined(EL9)
 #else
 	.prime_fd_to_handle = drm_gem_prime_fd_to_handle,
@@ -162,13 +173,72 @@ static struct drm_driver driver = {
 	.patchlevel = DRIVER_PATCH,
 };
 
+static void evdi_heads_cleanup(struct evdi_device *evdi)
+{
+	unsigned int i;
+
+	for (i = 0; i < evdi->num_heads; ++i) {
+		struct evdi_head *head = &evdi->heads[i];
+
+		if (head->cursor)
+			evdi_cursor_free(head->cursor);
+		head->cursor = NULL;
+		if (head->painter)
+			evdi_painter_cleanup(head->painter);
+		head->painter = NULL;
+	}
+}
+
+static int evdi_heads_init(struct evdi_device *evdi)
+{
+	unsigned int i;
+	int ret;
+
+	evdi->num_heads = clamp_t(unsigned int, evdi_heads_per_device,
+				  1, EVDI_MAX_HEADS);
+	for (i = 0; i < evdi->num_heads; ++i) {
+		struct evdi_head *head = &evdi->heads[i];
+
+		head->evdi = evdi;
+		head->index = i;
+		head->cursor_events_enabled = false;
+		head->num_overlays = min_t(unsigned int, evdi_overlay_planes,
+					   EVDI_MAX_OVERLAYS);
+		ret = evdi_painter_init(head);
+		if (ret)
+			return ret;
+		ret = evdi_cursor_init(&head->cursor);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+struct evdi_head *evdi_head_get(struct evdi_device *evdi, int32_t index)
+{
+	if (index < 0 || (unsigned int)index >= evdi->num_heads) {
+		EVDI_WARN("(card%d) No head %d\n", evdi->dev_index, index);
+		return NULL;
+	}
+
+	return &evdi->heads[index];
+}
+
 static void evdi_drm_device_release_cb(__always_unused struct drm_device *dev,
 				       __always_unused void *ptr)
 {
 	struct evdi_device *evdi = dev->dev_private;
 
-	evdi_cursor_free(evdi->cursor);
-	evdi_painter_cleanup(evdi->painter);
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	debugfs_lookup_and_remove("huge_pages", dev->debugfs_root);
+	debugfs_lookup_and_remove("vmap_cache", dev->debugfs_root);
+	debugfs_lookup_and_remove("numa_pages", dev->debugfs_root);
+#endif
+	destroy_workqueue(evdi->commit_wq);
+	evdi_heads_cleanup(evdi);
+	evdi_vmap_cache_cleanup(&evdi->vmap_cache);
+	kfree(evdi->node_pages);
 	kfree(evdi);
 	dev->dev_private = NULL;
 	EVDI_INFO("Evdi drm_device removed.\n");
@@ -176,6 +246,30 @@ static void evdi_drm_device_release_cb(__always_unused struct drm_device *dev,
 	EVDI_TEST_HOOK(evdi_testhook_drm_device_destroyed());
 }
 
+int evdi_numa_node(struct evdi_device *evdi)
+{
+	const int node = READ_ONCE(evdi->numa_node);
+
+	return node != NUMA_NO_NODE ? node : dev_to_node(evdi->ddev->dev);
+}
+
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+static int evdi_numa_pages_show(struct seq_file *m,
+				__always_unused void *unused)
+{
+	struct evdi_device *evdi = m->private;
+	int node;
+
+	seq_printf(m, "affinity: %d\n", evdi_numa_node(evdi));
+	for_each_node(node)
+		seq_printf(m, "node%d: %ld\n", node,
+			   atomic_long_read(&evdi->node_pages[node]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(evdi_numa_pages);
+#endif
+
 static int evdi_drm_device_init(struct drm_device *dev)
 {
 	struct evdi_device *evdi;
@@ -188,12 +282,39 @@ static int evdi_drm_device_init(struct drm_device *dev)
 
 	evdi->ddev = dev;
 	evdi->dev_index = dev->primary->index;
-	evdi->cursor_events_enabled = false;
+	atomic_set(&evdi->huge_pages, 0);
+	evdi->numa_node = NUMA_NO_NODE;
+	evdi->flip_policy = EVDI_FLIP_BLOCK;
+	evdi->flip_timeout_ms = 100;
+	evdi->node_pages = kcalloc(nr_node_ids, sizeof(*evdi->node_pages),
+				   GFP_KERNEL);
+	if (!evdi->node_pages) {
+		kfree(evdi);
+		return -ENOMEM;
+	}
+	ret = evdi_vmap_cache_init(&evdi->vmap_cache, evdi->dev_index);
+	if (ret) {
+		kfree(evdi->node_pages);
+		kfree(evdi);
+		return ret;
+	}
+	evdi->commit_wq = alloc_ordered_workqueue("evdi-commit-card%d", 0,
+						  evdi->dev_index);
+	if (!evdi->commit_wq) {
+		evdi_vmap_cache_cleanup(&evdi->vmap_cache);
+		kfree(evdi->node_pages);
+		kfree(evdi);
+		return -ENOMEM;
+	}
 	dev->dev_private = evdi;
-	ret = evdi_painter_init(evdi);
-	if (ret)
-		goto err_free;
-	ret =  evdi_cursor_init(&evdi->cursor);
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	debugfs_create_atomic_t("huge_pages", 0444, dev->debugfs_root,
+				&evdi->huge_pages);
+	evdi_vmap_cache_debugfs_init(&evdi->vmap_cache, dev->debugfs_root);
+	debugfs_create_file("numa_pages", 0444, dev->debugfs_root, evdi,
+			    &evdi_numa_pages_fops);
+#endif
+	ret = evdi_heads_init(evdi);
 	if (ret)
 		goto err_free;
 
@@ -204,7 +325,7 @@ static int evdi_drm_device_init(struct drm_device *dev)
 		goto err_init;
 #endif /* CONFIG_FB */
 
-	ret = drm_vblank_init(dev, 1);
+	ret = drm_vblank_init(dev, evdi->num_heads);
 	if (ret)
 		goto err_init;
 	drm_kms_helper_poll_init(dev);
@@ -223,8 +344,15 @@ err_init:
 #endif /* CONFIG_FB */
 err_free:
 	EVDI_ERROR("Failed to setup drm device %d\n", ret);
-	evdi_cursor_free(evdi->cursor);
-	kfree(evdi->painter);
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	debugfs_lookup_and_remove("huge_pages", dev->debugfs_root);
+	debugfs_lookup_and_remove("vmap_cache", dev->debugfs_root);
+	debugfs_lookup_and_remove("numa_pages", dev->debugfs_root);
+#endif
+	destroy_workqueue(evdi->commit_wq);
+	evdi_heads_cleanup(evdi);
+	evdi_vmap_cache_cleanup(&evdi->vmap_cache);
+	kfree(evdi->node_pages);
 	kfree(evdi);
 	dev->dev_private = NULL;
 	return ret;
@@ -288,6 +416,8 @@ err_free:
 
 static void evdi_drm_device_deinit(struct drm_device *dev)
 {
+	struct evdi_device *evdi = dev->dev_private;
+
 	drm_kms_helper_poll_fini(dev);
 #ifdef CONFIG_FB
 	evdi_fbdev_unplug(dev);
@@ -295,6 +425,7 @@ static void evdi_drm_device_deinit(struct drm_device *dev)
 #endif /* CONFIG_FB */
 	evdi_modeset_cleanup(dev);
 	drm_atomic_helper_shutdown(dev);
+	flush_workqueue(evdi->commit_wq);
 }
 
 int evdi_drm_device_remove(struct drm_device *dev)
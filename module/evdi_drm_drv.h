@@ -39,23 +39,94 @@
 #include <drm/drm_fb_helper.h>
 
 #include "evdi_debug.h"
+#include "evdi_vmap_cache.h"
 #include "tests/evdi_test.h"
 
 struct evdi_fbdev;
 struct evdi_painter;
+struct evdi_color;
+struct mem_cgroup;
 
-struct evdi_device {
-	struct drm_device *ddev;
+enum evdi_flip_policy {
+	/* Hold the flip until the client grabs the damage */
+	EVDI_FLIP_BLOCK,
+	/* Hold the flip for at most flip_timeout_ms */
+	EVDI_FLIP_TIMEOUT,
+	/* Complete the flip right away, damage stays pending */
+	EVDI_FLIP_IMMEDIATE,
+};
+
+#define EVDI_MAX_HEADS 16
+#define EVDI_MAX_OVERLAYS 4
+
+/* Framebuffer of an overlay plane, composed over the primary at grab time */
+struct evdi_overlay {
+	struct evdi_framebuffer *efb;
+	/* Top left of the shown part of the framebuffer */
+	int src_x;
+	int src_y;
+	/* Where it is shown on the CRTC, overlays are not scaled */
+	struct drm_rect dst;
+};
+
+/*
+ * Where composed pixels are written: the client buffer of a grab, or a
+ * writeback framebuffer mapped in the kernel. Offsets are in bytes.
+ */
+struct evdi_pixel_dst {
+	char __user *user;
+	char *kernel;
+	int stride;
+};
+
+/* A CRTC, encoder and connector pair with the painter serving it */
+struct evdi_head {
+	struct evdi_device *evdi;
+	unsigned int index;
+
+	struct drm_crtc *crtc;
 	struct drm_connector *conn;
 	struct evdi_cursor *cursor;
+	unsigned int num_overlays;
+	struct drm_plane *overlays[EVDI_MAX_OVERLAYS];
 	bool cursor_events_enabled;
 
 	uint32_t pixel_area_limit;
 	uint32_t pixel_per_second_limit;
 
-	struct evdi_fbdev *fbdev;
 	struct evdi_painter *painter;
 	struct i2c_adapter *i2c_adapter;
+};
+
+struct evdi_device {
+	struct drm_device *ddev;
+	struct evdi_fbdev *fbdev;
+
+	unsigned int num_heads;
+	struct evdi_head heads[EVDI_MAX_HEADS];
+
+	atomic_t huge_pages;
+	struct evdi_vmap_cache vmap_cache;
+	/* Sends painter notifications of commits in commit order */
+	struct workqueue_struct *commit_wq;
+
+	/* Preferred node for buffer pages, NUMA_NO_NODE follows the parent */
+	int numa_node;
+	/* Pinned buffer pages per node, nr_node_ids entries */
+	atomic_long_t *node_pages;
+
+	/* Dumb buffer pitch alignment in bytes, 0 keeps the default per format */
+	unsigned int pitch_align;
+	/* Pad pitches which are a multiple of 4 KiB by one alignment unit */
+	bool pitch_stagger;
+
+	/* When to complete a flip while damage waits for a grab */
+	enum evdi_flip_policy flip_policy;
+	unsigned int flip_timeout_ms;
+
+	/* Variable refresh range overriding the EDID, 0 if not set */
+	unsigned int vrr_min_hz;
+	unsigned int vrr_max_hz;
 
 	int dev_index;
 };
@@ -71,6 +142,18 @@ struct evdi_gem_object {
 #endif
 	struct sg_table *sg;
 	bool allow_sw_cursor_rect_updates;
+	unsigned int huge_pages;
+	/* Memcg of the creator of a dumb buffer, keys its reuse by the pool */
+	struct mem_cgroup *memcg;
+
+	/* Protected by evdi_vmap_cache.lock */
+	struct list_head vmap_lru;
+	unsigned int vmap_users;
+
+	/* Last handle found for the object, saves walking the handle idr */
+	spinlock_t handle_cache_lock;
+	struct drm_file *cached_file;
+	uint32_t cached_handle;
 };
 
 #define to_evdi_bo(x) container_of(x, struct evdi_gem_object, base)
@@ -87,11 +170,20 @@ struct evdi_framebuffer {
 /* modeset */
 void evdi_modeset_init(struct drm_device *dev);
 void evdi_modeset_cleanup(struct drm_device *dev);
-int evdi_connector_init(struct drm_device *dev, struct drm_encoder *encoder);
+int evdi_connector_init(struct drm_device *dev, struct drm_encoder *encoder,
+			struct evdi_head *head);
+bool evdi_connector_vrr_range(struct evdi_head *head,
+			      unsigned int *min_hz, unsigned int *max_hz);
 
-struct drm_encoder *evdi_encoder_init(struct drm_device *dev);
+struct drm_encoder *evdi_encoder_init(struct drm_device *dev,
+				      unsigned int index);
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+int evdi_writeback_init(struct drm_device *dev, struct evdi_head *head);
+#endif
+struct evdi_head *evdi_head_get(struct evdi_device *evdi, int32_t index);
 
 int evdi_driver_open(struct drm_device *drm_dev, struct drm_file *file);
+int evdi_numa_node(struct evdi_device *evdi);
 void evdi_driver_preclose(struct drm_device *dev, struct drm_file *file_priv);
 void evdi_driver_postclose(struct drm_device *dev, struct drm_file *file_priv);
 
@@ -121,12 +213,20 @@ int evdi_gem_mmap(struct drm_file *file_priv,
 		  struct drm_device *dev, uint32_t handle, uint64_t *offset);
 
 void evdi_gem_free_object(struct drm_gem_object *gem_obj);
+void evdi_gem_huge_mnt_init(void);
+void evdi_gem_huge_mnt_cleanup(void);
 struct evdi_gem_object *evdi_gem_alloc_object(struct drm_device *dev,
 					      size_t size);
 uint32_t evdi_gem_object_handle_lookup(struct drm_file *filp,
 				      struct drm_gem_object *obj);
+void evdi_gem_object_handle_cache(struct evdi_gem_object *obj,
+				  struct drm_file *filp, uint32_t handle);
+void evdi_gem_close_object(struct drm_gem_object *gem_obj,
+			   struct drm_file *file);
 
 struct sg_table *evdi_prime_get_sg_table(struct drm_gem_object *obj);
+struct drm_gem_object *evdi_gem_prime_import(struct drm_device *dev,
+					     struct dma_buf *dma_buf);
 struct drm_gem_object *
 evdi_prime_import_sg_table(struct drm_device *dev,
 			   struct dma_buf_attachment *attach,
@@ -134,6 +234,7 @@ evdi_prime_import_sg_table(struct drm_device *dev,
 
 int evdi_gem_vmap(struct evdi_gem_object *obj);
 void evdi_gem_vunmap(struct evdi_gem_object *obj);
+bool evdi_gem_vunmap_releases_pages(struct evdi_gem_object *obj);
 int evdi_drm_gem_mmap(struct file *filp, struct vm_area_struct *vma);
 
 #if KERNEL_VERSION(4, 17, 0) <= LINUX_VERSION_CODE
@@ -143,17 +244,24 @@ int evdi_gem_fault(struct vm_fault *vmf);
 #endif
 
 bool evdi_painter_is_connected(struct evdi_painter *painter);
+bool evdi_painter_is_scanout(struct evdi_painter *painter,
+			     struct evdi_framebuffer *efb);
 void evdi_painter_close(struct evdi_device *evdi, struct drm_file *file);
-u8 *evdi_painter_get_edid_copy(struct evdi_device *evdi);
+u8 *evdi_painter_get_edid_copy(struct evdi_head *head);
 int evdi_painter_get_num_dirts(struct evdi_painter *painter);
-void evdi_painter_mark_dirty(struct evdi_device *evdi,
+void evdi_painter_mark_fb_dirty(struct evdi_head *head,
+				struct evdi_framebuffer *efb,
+				const struct drm_clip_rect *rects,
+				int num_rects);
+void evdi_painter_mark_dirty(struct evdi_head *head,
 			     const struct drm_clip_rect *rect);
 void evdi_painter_set_vblank(struct evdi_painter *painter,
 			     struct drm_crtc *crtc,
-			     struct drm_pending_vblank_event *vblank);
+			     struct drm_pending_vblank_event *vblank,
+			     bool async);
 void evdi_painter_send_update_ready_if_needed(struct evdi_painter *painter);
 void evdi_painter_dpms_notify(struct evdi_painter *painter, int mode);
-void evdi_painter_mode_changed_notify(struct evdi_device *evdi,
+void evdi_painter_mode_changed_notify(struct evdi_head *head,
 				      struct drm_display_mode *mode);
 unsigned int evdi_painter_poll(struct file *filp,
 			       struct poll_table_struct *wait);
@@ -170,11 +278,24 @@ int evdi_painter_ddcci_response_ioctl(struct drm_device *drm_dev, void *data,
 				      struct drm_file *file);
 int evdi_painter_enable_cursor_events_ioctl(struct drm_device *drm_dev, void *data,
 					  struct drm_file *file);
+int evdi_painter_set_event_mask_ioctl(struct drm_device *drm_dev, void *data,
+				      struct drm_file *file);
+int evdi_painter_wait_and_grab_ioctl(struct drm_device *drm_dev, void *data,
+				     struct drm_file *file);
 
-int evdi_painter_init(struct evdi_device *evdi);
+int evdi_painter_init(struct evdi_head *head);
 void evdi_painter_cleanup(struct evdi_painter *painter);
 void evdi_painter_set_scanout_buffer(struct evdi_painter *painter,
-				     struct evdi_framebuffer *buffer);
+				     struct evdi_framebuffer *buffer,
+				     unsigned int rotation);
+void evdi_painter_set_overlay(struct evdi_painter *painter, unsigned int index,
+			      const struct evdi_overlay *overlay);
+void evdi_painter_set_color(struct evdi_painter *painter,
+			    struct evdi_color *color);
+int evdi_painter_writeback(struct evdi_head *head,
+			   struct evdi_framebuffer *wb_efb);
+int evdi_pixel_dst_write(const struct evdi_pixel_dst *dst, long offset,
+			 const void *src, unsigned long len);
 
 struct drm_clip_rect evdi_framebuffer_sanitize_rect(
 			const struct evdi_framebuffer *fb,
@@ -193,4 +314,11 @@ struct drm_clip_rect evdi_painter_framebuffer_size(struct evdi_painter *painter)
 bool evdi_painter_i2c_data_notify(struct evdi_painter *painter, struct i2c_msg *msg);
 
 int evdi_fb_get_bpp(uint32_t format);
+void evdi_fb_rotated_size(const struct drm_framebuffer *fb,
+			  unsigned int rotation, int *width, int *height);
+void evdi_fb_unrotate_point(const struct drm_framebuffer *fb,
+			    unsigned int rotation, int *x, int *y);
+bool evdi_fb_is_rgb8888(uint32_t format);
+bool evdi_fb_is_bgr(uint32_t format);
+uint32_t evdi_fb_convert_pixel(uint32_t pixel, uint32_t from, uint32_t to);
 #endif
@@ -46,7 +46,8 @@ static const struct drm_encoder_funcs evdi_enc_funcs = {
 	.destroy = evdi_enc_destroy,
 };
 
-struct drm_encoder *evdi_encoder_init(struct drm_device *dev)
+struct drm_encoder *evdi_encoder_init(struct drm_device *dev,
+				      unsigned int index)
 {
 	struct drm_encoder *encoder;
 	int ret = 0;
@@ -64,7 +65,7 @@ struct drm_encoder *evdi_encoder_init(struct drm_device *dev)
 
 	drm_encoder_helper_add(encoder, &evdi_enc_helper_funcs);
 
-	encoder->possible_crtcs = 1;
+	encoder->possible_crtcs = BIT(index);
 	return encoder;
 
 err_encoder:
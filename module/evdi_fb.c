@@ -25,6 +25,7 @@
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_atomic.h>
+#include <drm/drm_blend.h>
 #include <drm/drm_print.h>
 #if KERNEL_VERSION(5, 0, 0) <= LINUX_VERSION_CODE || defined(EL8)
 #include <drm/drm_damage_helper.h>
@@ -95,13 +96,19 @@ static int evdi_handle_damage(struct evdi_framebuffer *fb,
 		evdi_framebuffer_sanitize_rect(fb, &dirty_rect);
 	struct drm_device *dev = fb->base.dev;
 	struct evdi_device *evdi = dev->dev_private;
+	unsigned int i;
 
 	EVDI_CHECKPT();
 
 	if (!fb->active)
 		return 0;
-	evdi_painter_set_scanout_buffer(evdi->painter, fb);
-	evdi_painter_mark_dirty(evdi, &rect);
+
+	/* The console is cloned to every head */
+	for (i = 0; i < evdi->num_heads; ++i) {
+		evdi_painter_set_scanout_buffer(evdi->heads[i].painter, fb,
+						DRM_MODE_ROTATE_0);
+		evdi_painter_mark_dirty(&evdi->heads[i], &rect);
+	}
 
 	return 0;
 }
@@ -242,8 +249,8 @@ static int evdi_user_framebuffer_dirty(
 	struct drm_modeset_acquire_ctx ctx;
 	struct drm_atomic_state *state;
 	struct drm_plane *plane;
-	int ret = 0;
 	unsigned int i;
+	int ret = 0;
 
 	EVDI_CHECKPT();
 
@@ -261,8 +268,10 @@ static int evdi_user_framebuffer_dirty(
 	}
 	state->acquire_ctx = &ctx;
 
-	for (i = 0; i < num_clips; ++i)
-		evdi_painter_mark_dirty(evdi, &clips[i]);
+	for (i = 0; i < evdi->num_heads; ++i)
+		if (evdi_painter_is_scanout(evdi->heads[i].painter, efb))
+			evdi_painter_mark_fb_dirty(&evdi->heads[i], efb,
+						   clips, num_clips);
 
 retry:
 
@@ -532,7 +541,7 @@ int evdi_fbdev_init(struct drm_device *dev)
 #if KERNEL_VERSION(5, 7, 0) <= LINUX_VERSION_CODE || defined(EL8)
 	ret = drm_fb_helper_init(dev, &efbdev->helper);
 #else
-	ret = drm_fb_helper_init(dev, &efbdev->helper, 1);
+	ret = drm_fb_helper_init(dev, &efbdev->helper, evdi->num_heads);
 #endif
 	if (ret) {
 		kfree(efbdev);
@@ -598,13 +607,59 @@ void evdi_fbdev_unplug(struct drm_device *dev)
 }
 #endif /* CONFIG_FB */
 
+/* Average bits per pixel, subsampled planes count by the pixels they cover */
 int evdi_fb_get_bpp(uint32_t format)
 {
 	const struct drm_format_info *info = drm_format_info(format);
+	int bpp = 0;
+	int i;
 
 	if (!info)
 		return 0;
-	return info->cpp[0] * 8;
+	for (i = 0; i < info->num_planes; ++i)
+		bpp += info->cpp[i] * 8 / (i ? info->hsub * info->vsub : 1);
+	return bpp;
+}
+
+/* Size of the framebuffer as shown on the CRTC with a rotation */
+void evdi_fb_rotated_size(const struct drm_framebuffer *fb,
+			  unsigned int rotation, int *width, int *height)
+{
+	const bool swap = drm_rotation_90_or_270(rotation);
+
+	*width = swap ? fb->height : fb->width;
+	*height = swap ? fb->width : fb->height;
+}
+
+/* Position in the framebuffer of the pixel shown at x, y on the CRTC */
+void evdi_fb_unrotate_point(const struct drm_framebuffer *fb,
+			    unsigned int rotation, int *x, int *y)
+{
+	struct drm_rect r = { *x, *y, *x + 1, *y + 1 };
+
+	drm_rect_rotate_inv(&r, fb->width, fb->height, rotation);
+	*x = r.x1;
+	*y = r.y1;
+}
+
+bool evdi_fb_is_rgb8888(uint32_t format)
+{
+	return format == DRM_FORMAT_XRGB8888 || format == DRM_FORMAT_ARGB8888 ||
+	       format == DRM_FORMAT_XBGR8888 || format == DRM_FORMAT_ABGR8888;
+}
+
+bool evdi_fb_is_bgr(uint32_t format)
+{
+	return format == DRM_FORMAT_XBGR8888 || format == DRM_FORMAT_ABGR8888;
+}
+
+/* Converts a 32 bpp pixel between RGB and BGR orders, alpha is kept */
+uint32_t evdi_fb_convert_pixel(uint32_t pixel, uint32_t from, uint32_t to)
+{
+	if (evdi_fb_is_bgr(from) == evdi_fb_is_bgr(to))
+		return pixel;
+	return (pixel & 0xff00ff00) | ((pixel & 0xff) << 16) |
+	       ((pixel >> 16) & 0xff);
 }
 
 #if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE
@@ -633,29 +688,47 @@ struct drm_framebuffer *evdi_fb_user_fb_create(
 #endif
 					const struct drm_mode_fb_cmd2 *mode_cmd)
 {
+	const struct drm_format_info *format =
+		drm_format_info(mode_cmd->pixel_format);
 	struct drm_gem_object *obj;
 	struct evdi_framebuffer *efb;
 	int ret;
 	uint32_t size;
 	int bpp = evdi_fb_get_bpp(mode_cmd->pixel_format);
+	int i;
 
-	if (bpp != 32) {
+	if (bpp != 32 && bpp != 16 &&
+	    mode_cmd->pixel_format != DRM_FORMAT_NV12) {
 		EVDI_ERROR("Unsupported bpp (%d)\n", bpp);
 		return ERR_PTR(-EINVAL);
 	}
 
+	/* The painter maps one object, so all planes must share it */
+	for (i = 1; i < format->num_planes; ++i) {
+		if (mode_cmd->handles[i] != mode_cmd->handles[0]) {
+			EVDI_ERROR("Planes in separate buffers are not supported\n");
+			return ERR_PTR(-EINVAL);
+		}
+	}
+
 	obj = drm_gem_object_lookup(file, mode_cmd->handles[0]);
 	if (obj == NULL)
 		return ERR_PTR(-ENOENT);
 
-	size = mode_cmd->offsets[0] + mode_cmd->pitches[0] * mode_cmd->height;
-	size = ALIGN(size, PAGE_SIZE);
+	for (i = 0; i < format->num_planes; ++i) {
+		const uint32_t height = i ?
+			DIV_ROUND_UP(mode_cmd->height, format->vsub) :
+			mode_cmd->height;
 
-	if (size > obj->size) {
-		DRM_ERROR("object size not sufficient for fb %d %zu %u %d %d\n",
-			  size, obj->size, mode_cmd->offsets[0],
-			  mode_cmd->pitches[0], mode_cmd->height);
-		goto err_no_mem;
+		size = mode_cmd->offsets[i] + mode_cmd->pitches[i] * height;
+		size = ALIGN(size, PAGE_SIZE);
+
+		if (size > obj->size) {
+			DRM_ERROR("object size not sufficient for fb %d %zu %u %d %d\n",
+				  size, obj->size, mode_cmd->offsets[i],
+				  mode_cmd->pitches[i], height);
+			goto err_no_mem;
+		}
 	}
 
 	efb = kzalloc(sizeof(*efb), GFP_KERNEL);
@@ -26,10 +26,22 @@
 #include <drm/drm_print.h>
 #include "evdi_drm_drv.h"
 #include "evdi_params.h"
+#include "evdi_gem_pool.h"
 #include <linux/shmem_fs.h>
 #include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/dma-resv.h>
 #include <drm/drm_cache.h>
 #include <linux/vmalloc.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mount.h>
+#include <linux/sizes.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+#include <linux/memcontrol.h>
+#include <linux/sched/mm.h>
 
 
 #if KERNEL_VERSION(6, 13, 0) <= LINUX_VERSION_CODE || defined(EL10)
@@ -41,6 +53,9 @@ MODULE_IMPORT_NS(DMA_BUF);
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(EL8)
 static int evdi_prime_pin(struct drm_gem_object *obj);
 static void evdi_prime_unpin(struct drm_gem_object *obj);
+#if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
+static struct dma_buf *evdi_prime_export(struct drm_gem_object *obj, int flags);
+#endif
 
 static const struct vm_operations_struct evdi_gem_vm_ops = {
 	.fault = evdi_gem_fault,
@@ -53,11 +68,101 @@ static struct drm_gem_object_funcs gem_obj_funcs = {
 	.pin = evdi_prime_pin,
 	.unpin = evdi_prime_unpin,
 	.vm_ops = &evdi_gem_vm_ops,
+#if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
+	.export = evdi_prime_export,
+#else
 	.export = drm_gem_prime_export,
+#endif
 	.get_sg_table = evdi_prime_get_sg_table,
+	.close = evdi_gem_close_object,
 };
 #endif
 
+#if KERNEL_VERSION(6, 12, 0) <= LINUX_VERSION_CODE && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+/*
+ * Private tmpfs mount which backs large buffers with huge pages. This cuts
+ * the number of page cache entries and allocations per buffer. Client and
+ * kernel mappings are still built from 4 KiB entries, see
+ * evdi_gem_insert_pages.
+ */
+static struct vfsmount *evdi_gem_huge_mnt;
+
+void evdi_gem_huge_mnt_init(void)
+{
+	struct file_system_type *type = get_fs_type("tmpfs");
+	char huge_opt[] = "huge=within_size";
+	struct vfsmount *mnt;
+
+	if (!type)
+		return;
+
+	mnt = vfs_kern_mount(type, SB_KERNMOUNT, type->name, huge_opt);
+	if (IS_ERR(mnt)) {
+		EVDI_WARN("Huge page backed buffers not available: %ld\n",
+			  PTR_ERR(mnt));
+		return;
+	}
+
+	evdi_gem_huge_mnt = mnt;
+}
+
+void evdi_gem_huge_mnt_cleanup(void)
+{
+	if (evdi_gem_huge_mnt)
+		kern_unmount(evdi_gem_huge_mnt);
+	evdi_gem_huge_mnt = NULL;
+}
+
+static int evdi_gem_object_init(struct drm_device *dev,
+				struct drm_gem_object *obj, size_t size)
+{
+	const size_t threshold = (size_t)evdi_huge_pages_threshold_kb * SZ_1K;
+
+	if (evdi_gem_huge_mnt && threshold && size >= threshold)
+		return drm_gem_object_init_with_mnt(dev, obj, size,
+						    evdi_gem_huge_mnt);
+
+	return drm_gem_object_init(dev, obj, size);
+}
+
+static unsigned int evdi_gem_count_huge_pages(struct page **pages,
+					      unsigned long page_count)
+{
+	unsigned int count = 0;
+	unsigned long i;
+
+	for (i = 0; i < page_count; ++i) {
+		struct folio *folio = page_folio(pages[i]);
+
+		if (folio_test_pmd_mappable(folio) &&
+		    folio_page(folio, 0) == pages[i])
+			++count;
+	}
+
+	return count;
+}
+#else
+void evdi_gem_huge_mnt_init(void)
+{
+}
+
+void evdi_gem_huge_mnt_cleanup(void)
+{
+}
+
+static int evdi_gem_object_init(struct drm_device *dev,
+				struct drm_gem_object *obj, size_t size)
+{
+	return drm_gem_object_init(dev, obj, size);
+}
+
+static unsigned int evdi_gem_count_huge_pages(__always_unused struct page **pages,
+					      __always_unused unsigned long page_count)
+{
+	return 0;
+}
+#endif
+
 static bool evdi_was_called_by_mutter(void)
 {
 	char task_comm[TASK_COMM_LEN] = { 0 };
@@ -75,13 +180,55 @@ static bool evdi_drm_gem_object_use_import_attach(struct drm_gem_object *obj)
 	return strcmp(obj->import_attach->dmabuf->owner->name, "amdgpu") != 0;
 }
 
+void evdi_gem_object_handle_cache(struct evdi_gem_object *obj,
+				  struct drm_file *filp, uint32_t handle)
+{
+	spin_lock(&obj->handle_cache_lock);
+	obj->cached_file = handle ? filp : NULL;
+	obj->cached_handle = handle;
+	spin_unlock(&obj->handle_cache_lock);
+}
+
+static uint32_t evdi_gem_object_cached_handle(struct evdi_gem_object *obj,
+					      struct drm_file *filp)
+{
+	uint32_t handle = 0;
+
+	spin_lock(&obj->handle_cache_lock);
+	if (obj->cached_file == filp)
+		handle = obj->cached_handle;
+	spin_unlock(&obj->handle_cache_lock);
+
+	return handle;
+}
+
+void evdi_gem_close_object(struct drm_gem_object *gem_obj,
+			   struct drm_file *file)
+{
+	struct evdi_gem_object *obj = to_evdi_bo(gem_obj);
+
+	spin_lock(&obj->handle_cache_lock);
+	if (obj->cached_file == file) {
+		obj->cached_file = NULL;
+		obj->cached_handle = 0;
+	}
+	spin_unlock(&obj->handle_cache_lock);
+}
+
 uint32_t evdi_gem_object_handle_lookup(struct drm_file *filp,
 				       struct drm_gem_object *obj)
 {
-	uint32_t it_handle = 0;
+	struct evdi_gem_object *eobj = to_evdi_bo(obj);
+	uint32_t it_handle = evdi_gem_object_cached_handle(eobj, filp);
 	struct drm_gem_object *it_obj = NULL;
 
 	spin_lock(&filp->table_lock);
+	/* Handles are recycled, so only trust the cache if it still matches */
+	if (it_handle && idr_find(&filp->object_idr, it_handle) == obj) {
+		spin_unlock(&filp->table_lock);
+		return it_handle;
+	}
+
 	idr_for_each_entry(&filp->object_idr, it_obj, it_handle) {
 		if (it_obj == obj)
 			break;
@@ -91,11 +238,14 @@ uint32_t evdi_gem_object_handle_lookup(struct drm_file *filp,
 	if (!it_obj)
 		it_handle = 0;
 
+	evdi_gem_object_handle_cache(eobj, filp, it_handle);
+
 	return it_handle;
 }
 
-struct evdi_gem_object *evdi_gem_alloc_object(struct drm_device *dev,
-					      size_t size)
+static struct evdi_gem_object *
+evdi_gem_alloc_object_with_file(struct drm_device *dev, size_t size,
+				struct file *filp)
 {
 	struct evdi_gem_object *obj;
 
@@ -103,7 +253,10 @@ struct evdi_gem_object *evdi_gem_alloc_object(struct drm_device *dev,
 	if (obj == NULL)
 		return NULL;
 
-	if (drm_gem_object_init(dev, &obj->base, size) != 0) {
+	if (filp) {
+		drm_gem_private_object_init(dev, &obj->base, size);
+		obj->base.filp = filp;
+	} else if (evdi_gem_object_init(dev, &obj->base, size) != 0) {
 		kfree(obj);
 		return NULL;
 	}
@@ -116,23 +269,36 @@ struct evdi_gem_object *evdi_gem_alloc_object(struct drm_device *dev,
 	obj->allow_sw_cursor_rect_updates = false;
 
 	mutex_init(&obj->pages_lock);
+	spin_lock_init(&obj->handle_cache_lock);
+	INIT_LIST_HEAD(&obj->vmap_lru);
 
 	return obj;
 }
 
+struct evdi_gem_object *evdi_gem_alloc_object(struct drm_device *dev,
+					      size_t size)
+{
+	return evdi_gem_alloc_object_with_file(dev, size, NULL);
+}
+
 static int
 evdi_gem_create(struct drm_file *file,
 		struct drm_device *dev, uint64_t size, uint32_t *handle_p)
 {
 	struct evdi_gem_object *obj;
+	struct file *filp;
 	int ret;
 	u32 handle;
 
 	size = roundup(size, PAGE_SIZE);
 
-	obj = evdi_gem_alloc_object(dev, size);
-	if (obj == NULL)
+	filp = evdi_gem_pool_get(size);
+	obj = evdi_gem_alloc_object_with_file(dev, size, filp);
+	if (obj == NULL) {
+		if (filp)
+			fput(filp);
 		return -ENOMEM;
+	}
 
 	obj->allow_sw_cursor_rect_updates = evdi_was_called_by_mutter();
 	ret = drm_gem_handle_create(file, &obj->base, &handle);
@@ -141,6 +307,7 @@ evdi_gem_create(struct drm_file *file,
 		kfree(obj);
 		return ret;
 	}
+	obj->memcg = evdi_gem_pool_current_memcg();
 #if KERNEL_VERSION(5, 9, 0) <= LINUX_VERSION_CODE || defined(EL8)
 	drm_gem_object_put(&obj->base);
 #else
@@ -150,10 +317,12 @@ evdi_gem_create(struct drm_file *file,
 	return 0;
 }
 
-static int evdi_align_pitch(int width, int cpp)
+static int evdi_align_pitch(struct evdi_device *evdi, int width, int cpp)
 {
+	const unsigned int align = READ_ONCE(evdi->pitch_align);
 	int aligned = width;
 	int pitch_mask = 0;
+	int pitch, unit;
 
 	switch (cpp) {
 	case 1:
@@ -168,20 +337,66 @@ static int evdi_align_pitch(int width, int cpp)
 		break;
 	}
 
-	aligned += pitch_mask;
-	aligned &= ~pitch_mask;
-	return aligned * cpp;
+	if (align) {
+		unit = align;
+		pitch = ALIGN(width * cpp, align);
+	} else {
+		unit = (pitch_mask + 1) * cpp;
+		aligned += pitch_mask;
+		aligned &= ~pitch_mask;
+		pitch = aligned * cpp;
+	}
+
+	/* Rows a multiple of 4 KiB apart compete for the same cache sets */
+	if (READ_ONCE(evdi->pitch_stagger) && pitch % SZ_4K == 0 &&
+	    unit % SZ_4K != 0)
+		pitch += unit;
+
+	return pitch;
 }
 
 int evdi_dumb_create(struct drm_file *file,
 		     struct drm_device *dev, struct drm_mode_create_dumb *args)
 {
-	args->pitch = evdi_align_pitch(args->width, DIV_ROUND_UP(args->bpp, 8));
+	args->pitch = evdi_align_pitch(dev->dev_private, args->width,
+				       DIV_ROUND_UP(args->bpp, 8));
 
 	args->size = args->pitch * args->height;
 	return evdi_gem_create(file, dev, args->size, &args->handle);
 }
 
+/*
+ * Maps up to count pages of the object starting at first, stopping early
+ * at a page which is already mapped. Pages are mapped one PTE each, also
+ * when they belong to a huge folio.
+ */
+static int evdi_gem_insert_pages(struct vm_area_struct *vma,
+				 unsigned long address,
+				 struct evdi_gem_object *obj,
+				 pgoff_t first, unsigned long count)
+{
+#if KERNEL_VERSION(5, 8, 0) <= LINUX_VERSION_CODE
+	unsigned long num = count;
+
+	return vm_insert_pages(vma, address, &obj->pages[first], &num);
+#else
+	return vm_insert_page(vma, address, obj->pages[first]);
+#endif
+}
+
+static void evdi_gem_populate(struct vm_area_struct *vma)
+{
+	struct evdi_gem_object *obj = to_evdi_bo(vma->vm_private_data);
+	const unsigned long num_pages = obj->base.size >> PAGE_SHIFT;
+	const unsigned long mapped_pages = vma_pages(vma);
+
+	if (!obj->pages)
+		return;
+
+	evdi_gem_insert_pages(vma, vma->vm_start, obj, 0,
+			      min(num_pages, mapped_pages));
+}
+
 int evdi_drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 {
 	int ret;
@@ -198,6 +413,9 @@ int evdi_drm_gem_mmap(struct file *filp, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_MIXEDMAP;
 #endif
 
+	if (evdi_mmap_populate)
+		evdi_gem_populate(vma);
+
 	return ret;
 }
 
@@ -211,9 +429,9 @@ int evdi_gem_fault(struct vm_fault *vmf)
 	struct vm_area_struct *vma = vmf->vma;
 #endif
 	struct evdi_gem_object *obj = to_evdi_bo(vma->vm_private_data);
-	struct page *page;
 	pgoff_t page_offset;
 	loff_t num_pages = obj->base.size >> PAGE_SHIFT;
+	unsigned long count;
 	int ret = 0;
 
 	page_offset = (vmf->address - vma->vm_start) >> PAGE_SHIFT;
@@ -221,8 +439,12 @@ int evdi_gem_fault(struct vm_fault *vmf)
 	if (!obj->pages || page_offset >= (unsigned long)num_pages)
 		return VM_FAULT_SIGBUS;
 
-	page = obj->pages[page_offset];
-	ret = vm_insert_page(vma, vmf->address, page);
+	/* Map the pages following the faulting one as well */
+	count = min3((unsigned long)num_pages - page_offset,
+		     (vma->vm_end - vmf->address) >> PAGE_SHIFT,
+		     ((unsigned long)evdi_mmap_fault_around_kb * SZ_1K) >> PAGE_SHIFT);
+	ret = evdi_gem_insert_pages(vma, vmf->address, obj, page_offset,
+				    max(count, 1UL));
 	switch (ret) {
 	case -EAGAIN:
 	case 0:
@@ -237,20 +459,95 @@ int evdi_gem_fault(struct vm_fault *vmf)
 	return VM_FAULT_SIGBUS;
 }
 
+#if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE
+struct evdi_gem_get_pages_args {
+	struct drm_gem_object *obj;
+	struct mem_cgroup *memcg;
+};
+
+/* Runs on a kworker, the pages are charged to the memcg of the caller */
+static long evdi_gem_get_pages_work(void *data)
+{
+	struct evdi_gem_get_pages_args *args = data;
+	struct mem_cgroup *old_memcg = set_active_memcg(args->memcg);
+	struct page **pages = drm_gem_get_pages(args->obj);
+
+	set_active_memcg(old_memcg);
+	return (long)pages;
+}
+#endif
+
+/* New page cache pages are allocated on the node of the allocating CPU */
+static struct page **evdi_gem_get_pages_on_node(struct drm_gem_object *obj,
+						int node)
+{
+#if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE
+	struct evdi_gem_get_pages_args args = { .obj = obj };
+	struct page **pages;
+	unsigned int cpu;
+
+	if (node == NUMA_NO_NODE || node == numa_node_id())
+		return drm_gem_get_pages(obj);
+
+	cpu = cpumask_any_and(cpumask_of_node(node), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return drm_gem_get_pages(obj);
+
+	args.memcg = get_mem_cgroup_from_mm(current->mm);
+	pages = (struct page **)work_on_cpu(cpu, evdi_gem_get_pages_work, &args);
+	mem_cgroup_put(args.memcg);
+
+	return pages;
+#else
+	/* Without set_active_memcg a worker would charge its own memcg */
+	return drm_gem_get_pages(obj);
+#endif
+}
+
+static void evdi_gem_account_nodes(struct evdi_device *evdi,
+				   struct page **pages, unsigned long count,
+				   long sign)
+{
+	unsigned long i, run = 0;
+	int node = NUMA_NO_NODE;
+
+	if (!evdi->node_pages)
+		return;
+
+	for (i = 0; i < count; ++i) {
+		const int page_node = page_to_nid(pages[i]);
+
+		if (page_node != node && run) {
+			atomic_long_add(sign * run, &evdi->node_pages[node]);
+			run = 0;
+		}
+		node = page_node;
+		run++;
+	}
+
+	if (run)
+		atomic_long_add(sign * run, &evdi->node_pages[node]);
+}
+
 static int evdi_gem_get_pages(struct evdi_gem_object *obj,
 			      __always_unused gfp_t gfpmask)
 {
+	struct evdi_device *evdi = obj->base.dev->dev_private;
+	const unsigned long page_count = DIV_ROUND_UP(obj->base.size, PAGE_SIZE);
 	struct page **pages;
 
 	if (obj->pages)
 		return 0;
 
-	pages = drm_gem_get_pages(&obj->base);
+	pages = evdi_gem_get_pages_on_node(&obj->base, evdi_numa_node(evdi));
 
 	if (IS_ERR(pages))
 		return PTR_ERR(pages);
 
 	obj->pages = pages;
+	obj->huge_pages = evdi_gem_count_huge_pages(pages, page_count);
+	atomic_add(obj->huge_pages, &evdi->huge_pages);
+	evdi_gem_account_nodes(evdi, pages, page_count, 1);
 
 #if defined(CONFIG_X86)
 	drm_clflush_pages(obj->pages, DIV_ROUND_UP(obj->base.size, PAGE_SIZE));
@@ -261,12 +558,19 @@ static int evdi_gem_get_pages(struct evdi_gem_object *obj,
 
 static void evdi_gem_put_pages(struct evdi_gem_object *obj)
 {
+	struct evdi_device *evdi = obj->base.dev->dev_private;
+
 	if (obj->base.import_attach) {
 		kvfree(obj->pages);
 		obj->pages = NULL;
 		return;
 	}
 
+	atomic_sub(obj->huge_pages, &evdi->huge_pages);
+	obj->huge_pages = 0;
+	evdi_gem_account_nodes(evdi, obj->pages,
+			       DIV_ROUND_UP(obj->base.size, PAGE_SIZE), -1);
+
 	drm_gem_put_pages(&obj->base, obj->pages, false, false);
 	obj->pages = NULL;
 }
@@ -445,9 +749,25 @@ void evdi_gem_vunmap(struct evdi_gem_object *obj)
 	evdi_unpin_pages(obj);
 }
 
+/*
+ * Whether evdi_gem_vunmap gives pages back, which native buffers only do
+ * when the mapping is their last pin. Unmapping an import frees nothing
+ * of ours. Checked without pages_lock, so only a hint.
+ */
+bool evdi_gem_vunmap_releases_pages(struct evdi_gem_object *obj)
+{
+	if (evdi_drm_gem_object_use_import_attach(&obj->base))
+		return false;
+	return READ_ONCE(obj->pages_pin_count) == 1;
+}
+
 void evdi_gem_free_object(struct drm_gem_object *gem_obj)
 {
 	struct evdi_gem_object *obj = to_evdi_bo(gem_obj);
+	struct evdi_device *evdi = gem_obj->dev->dev_private;
+
+	if (evdi)
+		evdi_vmap_cache_remove(&evdi->vmap_cache, obj);
 
 	if (obj->vmapping)
 		evdi_gem_vunmap(obj);
@@ -461,6 +781,15 @@ void evdi_gem_free_object(struct drm_gem_object *gem_obj)
 	if (gem_obj->dev->vma_offset_manager)
 		drm_gem_free_mmap_offset(gem_obj);
 	mutex_destroy(&obj->pages_lock);
+
+	/* Keep the pages of native buffers for a buffer of the same size */
+	if (!gem_obj->import_attach &&
+	    evdi_gem_pool_put(gem_obj->filp, gem_obj->size, obj->memcg)) {
+		gem_obj->filp = NULL;
+		obj->memcg = NULL;
+	}
+	mem_cgroup_put(obj->memcg);
+
 	drm_gem_object_release(&obj->base);
 	kfree(obj);
 }
@@ -584,3 +913,205 @@ struct sg_table *evdi_prime_get_sg_table(struct drm_gem_object *obj)
 #endif
 }
 
+#if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
+/*
+ * The device mapping of each attachment is made on first use and kept
+ * until detach, so importers mapping the buffer every frame only pay for
+ * cache maintenance. It is made bidirectional, so it serves whatever
+ * direction later maps ask for and can be synced in any direction. The
+ * core's cache_sgt_mapping would refuse a map in another direction.
+ */
+struct evdi_dmabuf_attachment {
+	struct sg_table *sgt;
+};
+
+static int evdi_dmabuf_attach(struct dma_buf *dmabuf,
+			      struct dma_buf_attachment *attach)
+{
+	struct evdi_dmabuf_attachment *priv;
+	int ret;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	ret = drm_gem_map_attach(dmabuf, attach);
+	if (ret) {
+		kfree(priv);
+		return ret;
+	}
+
+	attach->priv = priv;
+	return 0;
+}
+
+static void evdi_dmabuf_detach(struct dma_buf *dmabuf,
+			       struct dma_buf_attachment *attach)
+{
+	struct evdi_dmabuf_attachment *priv = attach->priv;
+
+	if (priv->sgt) {
+		dma_unmap_sgtable(attach->dev, priv->sgt, DMA_BIDIRECTIONAL, 0);
+		sg_free_table(priv->sgt);
+		kfree(priv->sgt);
+	}
+	kfree(priv);
+	attach->priv = NULL;
+
+	drm_gem_map_detach(dmabuf, attach);
+}
+
+static struct sg_table *evdi_dmabuf_map(struct dma_buf_attachment *attach,
+					enum dma_data_direction dir)
+{
+	struct evdi_dmabuf_attachment *priv = attach->priv;
+	struct drm_gem_object *obj = attach->dmabuf->priv;
+	struct sg_table *sgt;
+	int ret;
+
+	if (WARN_ON(dir == DMA_NONE))
+		return ERR_PTR(-EINVAL);
+
+	if (priv->sgt) {
+		dma_sync_sgtable_for_device(attach->dev, priv->sgt, dir);
+		return priv->sgt;
+	}
+
+	sgt = evdi_prime_get_sg_table(obj);
+	if (IS_ERR(sgt))
+		return sgt;
+
+	ret = dma_map_sgtable(attach->dev, sgt, DMA_BIDIRECTIONAL, 0);
+	if (ret) {
+		sg_free_table(sgt);
+		kfree(sgt);
+		return ERR_PTR(ret);
+	}
+
+	priv->sgt = sgt;
+	return sgt;
+}
+
+static void evdi_dmabuf_unmap(__always_unused struct dma_buf_attachment *attach,
+			      __always_unused struct sg_table *sgt,
+			      __always_unused enum dma_data_direction dir)
+{
+	/* Kept until detach */
+}
+
+static int evdi_dmabuf_sync(struct dma_buf *dmabuf,
+			    enum dma_data_direction dir, bool for_cpu)
+{
+	struct dma_buf_attachment *attach;
+	int ret;
+
+	ret = dma_resv_lock_interruptible(dmabuf->resv, NULL);
+	if (ret)
+		return ret;
+
+	/* Only attachments which have mapped the buffer need maintenance */
+	list_for_each_entry(attach, &dmabuf->attachments, node) {
+		struct evdi_dmabuf_attachment *priv = attach->priv;
+
+		if (!priv || !priv->sgt)
+			continue;
+
+		if (for_cpu)
+			dma_sync_sgtable_for_cpu(attach->dev, priv->sgt, dir);
+		else
+			dma_sync_sgtable_for_device(attach->dev, priv->sgt, dir);
+	}
+
+	dma_resv_unlock(dmabuf->resv);
+	return 0;
+}
+
+static int evdi_dmabuf_begin_cpu_access(struct dma_buf *dmabuf,
+					enum dma_data_direction dir)
+{
+	return evdi_dmabuf_sync(dmabuf, dir, true);
+}
+
+static int evdi_dmabuf_end_cpu_access(struct dma_buf *dmabuf,
+				      enum dma_data_direction dir)
+{
+	return evdi_dmabuf_sync(dmabuf, dir, false);
+}
+
+static int evdi_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+	struct drm_gem_object *obj = dmabuf->priv;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > obj->size)
+		return -EINVAL;
+
+	drm_gem_object_get(obj);
+	vma->vm_ops = &evdi_gem_vm_ops;
+	vma->vm_private_data = obj;
+
+#if KERNEL_VERSION(6, 3, 0) <= LINUX_VERSION_CODE || defined(EL9)
+	vm_flags_mod(vma, VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP, VM_PFNMAP);
+#else
+	vma->vm_flags &= ~VM_PFNMAP;
+	vma->vm_flags |= VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+
+	vma->vm_page_prot = vm_get_page_prot(vma->vm_flags);
+	if (evdi_export_write_combined)
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+
+	if (evdi_mmap_populate)
+		evdi_gem_populate(vma);
+
+	return 0;
+}
+
+static const struct dma_buf_ops evdi_dmabuf_ops = {
+	.attach = evdi_dmabuf_attach,
+	.detach = evdi_dmabuf_detach,
+	.map_dma_buf = evdi_dmabuf_map,
+	.unmap_dma_buf = evdi_dmabuf_unmap,
+	.release = drm_gem_dmabuf_release,
+	.begin_cpu_access = evdi_dmabuf_begin_cpu_access,
+	.end_cpu_access = evdi_dmabuf_end_cpu_access,
+	.mmap = evdi_dmabuf_mmap,
+	.vmap = drm_gem_dmabuf_vmap,
+	.vunmap = drm_gem_dmabuf_vunmap,
+};
+
+static struct dma_buf *evdi_prime_export(struct drm_gem_object *obj, int flags)
+{
+	struct dma_buf_export_info exp_info = {
+		.exp_name = KBUILD_MODNAME,
+		.owner = THIS_MODULE,
+		.ops = &evdi_dmabuf_ops,
+		.size = obj->size,
+		.flags = flags,
+		.priv = obj,
+		.resv = obj->resv,
+	};
+
+	return drm_gem_dmabuf_export(obj->dev, &exp_info);
+}
+
+struct drm_gem_object *evdi_gem_prime_import(struct drm_device *dev,
+					     struct dma_buf *dma_buf)
+{
+	struct drm_gem_object *obj = dma_buf->priv;
+
+	/* Importing a buffer exported by this device */
+	if (dma_buf->ops == &evdi_dmabuf_ops && obj->dev == dev) {
+		drm_gem_object_get(obj);
+		return obj;
+	}
+
+	return drm_gem_prime_import(dev, dma_buf);
+}
+#else
+struct drm_gem_object *evdi_gem_prime_import(struct drm_device *dev,
+					     struct dma_buf *dma_buf)
+{
+	return drm_gem_prime_import(dev, dma_buf);
+}
+#endif
+
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/memcontrol.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/shmem_fs.h>
+#include <linux/sched.h>
+#include <linux/shrinker.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include "evdi_gem_pool.h"
+#include "evdi_params.h"
+#include "evdi_debug.h"
+
+struct evdi_gem_pool_entry {
+	struct list_head list;
+	struct file *filp;
+	size_t size;
+	/* Memcg the pages are charged to, only reused by its tasks */
+	struct mem_cgroup *memcg;
+};
+
+static struct evdi_gem_pool {
+	struct mutex lock;
+	/* Most recently released first */
+	struct list_head entries;
+	size_t size;
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	struct shrinker *shrinker;
+#else
+	struct shrinker shrinker;
+#endif
+} evdi_gem_pool;
+
+static void evdi_gem_pool_drop(struct evdi_gem_pool_entry *entry)
+{
+	list_del(&entry->list);
+	evdi_gem_pool.size -= entry->size;
+	fput(entry->filp);
+	mem_cgroup_put(entry->memcg);
+	kfree(entry);
+}
+
+static unsigned long evdi_gem_pool_evict(size_t budget)
+{
+	unsigned long freed = 0;
+
+	while (evdi_gem_pool.size > budget) {
+		struct evdi_gem_pool_entry *entry =
+			list_last_entry(&evdi_gem_pool.entries,
+					struct evdi_gem_pool_entry, list);
+
+		freed += entry->size >> PAGE_SHIFT;
+		evdi_gem_pool_drop(entry);
+	}
+
+	return freed;
+}
+
+static void evdi_gem_pool_truncate(struct file *filp, pgoff_t start,
+				   pgoff_t end)
+{
+	if (start < end)
+		shmem_truncate_range(file_inode(filp),
+				     (loff_t)start << PAGE_SHIFT,
+				     ((loff_t)end << PAGE_SHIFT) - 1);
+}
+
+/*
+ * Clears the pages still in memory. Pages which are not, holes or swapped
+ * out ones, are truncated rather than read back just to be cleared.
+ */
+static void evdi_gem_pool_clear(struct file *filp, size_t size)
+{
+	struct address_space *mapping = filp->f_mapping;
+	const pgoff_t count = size >> PAGE_SHIFT;
+	pgoff_t missing = 0;
+	pgoff_t i;
+
+	for (i = 0; i < count; ++i) {
+		struct page *page = find_lock_page(mapping, i);
+
+		if (!page)
+			continue;
+
+		evdi_gem_pool_truncate(filp, missing, i);
+		missing = i + 1;
+
+		clear_highpage(page);
+		set_page_dirty(page);
+		unlock_page(page);
+		put_page(page);
+		cond_resched();
+	}
+
+	evdi_gem_pool_truncate(filp, missing, count);
+}
+
+struct mem_cgroup *evdi_gem_pool_current_memcg(void)
+{
+#if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE
+	return get_mem_cgroup_from_mm(current->mm);
+#else
+	return NULL;
+#endif
+}
+
+/* Takes over the references to filp and memcg when returning true */
+bool evdi_gem_pool_put(struct file *filp, size_t size,
+		       struct mem_cgroup *memcg)
+{
+	const size_t budget = (size_t)evdi_gem_pool_mb * SZ_1M;
+	struct evdi_gem_pool_entry *entry;
+
+	if (!filp || size > budget)
+		return false;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry)
+		return false;
+
+	entry->filp = filp;
+	entry->size = size;
+	entry->memcg = memcg;
+
+	mutex_lock(&evdi_gem_pool.lock);
+	evdi_gem_pool_evict(budget - size);
+	list_add(&entry->list, &evdi_gem_pool.entries);
+	evdi_gem_pool.size += size;
+	mutex_unlock(&evdi_gem_pool.lock);
+
+	return true;
+}
+
+/*
+ * Returns a backing file of exactly size bytes, whose pages are charged to
+ * the memcg of the caller, or NULL
+ */
+struct file *evdi_gem_pool_get(size_t size)
+{
+	struct mem_cgroup *memcg = evdi_gem_pool_current_memcg();
+	struct evdi_gem_pool_entry *entry;
+	struct file *filp = NULL;
+
+	mutex_lock(&evdi_gem_pool.lock);
+	list_for_each_entry(entry, &evdi_gem_pool.entries, list) {
+		if (entry->size == size && entry->memcg == memcg) {
+			filp = entry->filp;
+			list_del(&entry->list);
+			evdi_gem_pool.size -= size;
+			mem_cgroup_put(entry->memcg);
+			kfree(entry);
+			break;
+		}
+	}
+	mutex_unlock(&evdi_gem_pool.lock);
+	mem_cgroup_put(memcg);
+
+	if (filp && evdi_gem_pool_zero)
+		evdi_gem_pool_clear(filp, size);
+
+	return filp;
+}
+
+static unsigned long evdi_gem_pool_count(__always_unused struct shrinker *shrinker,
+					 __always_unused struct shrink_control *sc)
+{
+	const unsigned long pages = READ_ONCE(evdi_gem_pool.size) >> PAGE_SHIFT;
+
+	return pages ? pages : SHRINK_EMPTY;
+}
+
+static unsigned long evdi_gem_pool_scan(__always_unused struct shrinker *shrinker,
+					struct shrink_control *sc)
+{
+	const size_t to_free = (size_t)sc->nr_to_scan << PAGE_SHIFT;
+	unsigned long freed;
+
+	if (!mutex_trylock(&evdi_gem_pool.lock))
+		return SHRINK_STOP;
+
+	freed = evdi_gem_pool_evict(evdi_gem_pool.size > to_free ?
+				    evdi_gem_pool.size - to_free : 0);
+	mutex_unlock(&evdi_gem_pool.lock);
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+int evdi_gem_pool_init(void)
+{
+	mutex_init(&evdi_gem_pool.lock);
+	INIT_LIST_HEAD(&evdi_gem_pool.entries);
+	evdi_gem_pool.size = 0;
+
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	evdi_gem_pool.shrinker = shrinker_alloc(0, "evdi-gem-pool");
+	if (!evdi_gem_pool.shrinker)
+		return -ENOMEM;
+
+	evdi_gem_pool.shrinker->count_objects = evdi_gem_pool_count;
+	evdi_gem_pool.shrinker->scan_objects = evdi_gem_pool_scan;
+	shrinker_register(evdi_gem_pool.shrinker);
+	return 0;
+#else
+	evdi_gem_pool.shrinker.count_objects = evdi_gem_pool_count;
+	evdi_gem_pool.shrinker.scan_objects = evdi_gem_pool_scan;
+	evdi_gem_pool.shrinker.seeks = DEFAULT_SEEKS;
+# if KERNEL_VERSION(6, 0, 0) <= LINUX_VERSION_CODE
+	return register_shrinker(&evdi_gem_pool.shrinker, "evdi-gem-pool");
+# else
+	return register_shrinker(&evdi_gem_pool.shrinker);
+# endif
+#endif
+}
+
+void evdi_gem_pool_cleanup(void)
+{
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	shrinker_free(evdi_gem_pool.shrinker);
+	evdi_gem_pool.shrinker = NULL;
+#else
+	unregister_shrinker(&evdi_gem_pool.shrinker);
+#endif
+
+	mutex_lock(&evdi_gem_pool.lock);
+	evdi_gem_pool_evict(0);
+	mutex_unlock(&evdi_gem_pool.lock);
+	mutex_destroy(&evdi_gem_pool.lock);
+}
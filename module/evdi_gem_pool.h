@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-only
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#ifndef EVDI_GEM_POOL_H
+#define EVDI_GEM_POOL_H
+
+#include <linux/types.h>
+
+struct file;
+struct mem_cgroup;
+
+/*
+ * Shmem backing files of freed evdi buffers, kept with their pages so
+ * that a buffer of the same size created soon after can reuse them.
+ * Files are only reused within the memcg their buffer was created in.
+ */
+int evdi_gem_pool_init(void);
+void evdi_gem_pool_cleanup(void);
+struct mem_cgroup *evdi_gem_pool_current_memcg(void);
+bool evdi_gem_pool_put(struct file *filp, size_t size,
+		       struct mem_cgroup *memcg);
+struct file *evdi_gem_pool_get(size_t size);
+
+#endif /* EVDI_GEM_POOL_H */
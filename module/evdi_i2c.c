@@ -15,8 +15,8 @@ static int dli2c_access_master(struct i2c_adapter *adapter,
 	struct i2c_msg *msgs, int num)
 {
 	int i = 0, result = 0;
-	struct evdi_device *evdi = adapter->algo_data;
-	struct evdi_painter *painter = evdi->painter;
+	struct evdi_head *head = adapter->algo_data;
+	struct evdi_painter *painter = head->painter;
 
 	for (i = 0; i < num; i++) {
 		if (evdi_painter_i2c_data_notify(painter, &msgs[i]))
@@ -37,7 +37,7 @@ static struct i2c_algorithm dli2c_algorithm = {
 };
 
 int evdi_i2c_add(struct i2c_adapter *adapter, struct device *parent,
-	void *ddev)
+	void *head)
 {
 	adapter->owner  = THIS_MODULE;
 #if KERNEL_VERSION(6, 8, 0) <= LINUX_VERSION_CODE || defined(EL9)
@@ -47,7 +47,7 @@ int evdi_i2c_add(struct i2c_adapter *adapter, struct device *parent,
 	adapter->algo   = &dli2c_algorithm;
 	strscpy(adapter->name, "DisplayLink I2C Adapter", sizeof(adapter->name));
 	adapter->dev.parent = parent;
-	adapter->algo_data = ddev;
+	adapter->algo_data = head;
 
 	return i2c_add_adapter(adapter);
 }
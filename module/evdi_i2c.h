@@ -14,7 +14,7 @@
 
 int evdi_i2c_add(struct i2c_adapter *adapter,
 		struct device *parent,
-		void *ddev);
+		void *head);
 void evdi_i2c_remove(struct i2c_adapter *adapter);
 
 #endif  /* EVDI_I2C_H */
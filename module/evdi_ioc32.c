@@ -40,6 +40,7 @@ struct drm_evdi_connect32 {
 	uint32_t edid_length;
 	uint32_t pixel_area_limit;
 	uint32_t pixel_per_second_limit;
+	int32_t head;
 };
 
 struct drm_evdi_grabpix32 {
@@ -50,16 +51,49 @@ struct drm_evdi_grabpix32 {
 	uint32_t buffer_ptr32;
 	int32_t num_rects;
 	uint32_t rects_ptr32;
+	int32_t head;
 };
 
+struct drm_evdi_wait_and_grab32 {
+	uint32_t mode;
+	int32_t buf_width;
+	int32_t buf_height;
+	int32_t buf_byte_stride;
+	uint32_t buffer_ptr32;
+	int32_t num_rects;
+	uint32_t rects_ptr32;
+	int32_t timeout_ms;
+	int32_t head;
+};
+
+/* Requests from clients built before heads existed end before the head */
+static int compat_copy_request(void *req32, size_t size, unsigned int cmd,
+			       unsigned long arg)
+{
+	memset(req32, 0, size);
+	if (copy_from_user(req32, (void __user *)arg,
+			   min_t(size_t, _IOC_SIZE(cmd), size)))
+		return -EFAULT;
+	return 0;
+}
+
+static int compat_copy_reply(unsigned long arg, const void *req32,
+			     size_t size, unsigned int cmd)
+{
+	if (copy_to_user((void __user *)arg, req32,
+			 min_t(size_t, _IOC_SIZE(cmd), size)))
+		return -EFAULT;
+	return 0;
+}
+
 static int compat_evdi_connect(struct file *file,
-				unsigned int __always_unused cmd,
+				unsigned int cmd,
 				unsigned long arg)
 {
 	struct drm_evdi_connect32 req32;
 	struct drm_evdi_connect krequest;
 
-	if (copy_from_user(&req32, (void __user *)arg, sizeof(req32)))
+	if (compat_copy_request(&req32, sizeof(req32), cmd, arg))
 		return -EFAULT;
 
 	krequest.connected = req32.connected;
@@ -68,19 +102,20 @@ static int compat_evdi_connect(struct file *file,
 	krequest.edid_length = req32.edid_length;
 	krequest.pixel_area_limit = req32.pixel_area_limit;
 	krequest.pixel_per_second_limit = req32.pixel_per_second_limit;
+	krequest.head = req32.head;
 
 	return drm_ioctl_kernel(file, evdi_painter_connect_ioctl, &krequest, 0);
 }
 
 static int compat_evdi_grabpix(struct file *file,
-				unsigned int __always_unused cmd,
+				unsigned int cmd,
 				unsigned long arg)
 {
 	struct drm_evdi_grabpix32 req32;
 	struct drm_evdi_grabpix krequest;
 	int ret;
 
-	if (copy_from_user(&req32, (void __user *)arg, sizeof(req32)))
+	if (compat_copy_request(&req32, sizeof(req32), cmd, arg))
 		return -EFAULT;
 
 	krequest.mode = req32.mode;
@@ -90,20 +125,50 @@ static int compat_evdi_grabpix(struct file *file,
 	krequest.buffer = compat_ptr(req32.buffer_ptr32);
 	krequest.num_rects = req32.num_rects;
 	krequest.rects = compat_ptr(req32.rects_ptr32);
+	krequest.head = req32.head;
 
 	ret = drm_ioctl_kernel(file, evdi_painter_grabpix_ioctl, &krequest, 0);
 	if (ret)
 		return ret;
 
 	req32.num_rects = krequest.num_rects;
-	if (copy_to_user((void __user *)arg, &req32, sizeof(req32)))
+	return compat_copy_reply(arg, &req32, sizeof(req32), cmd);
+}
+
+static int compat_evdi_wait_and_grab(struct file *file,
+				unsigned int cmd,
+				unsigned long arg)
+{
+	struct drm_evdi_wait_and_grab32 req32;
+	struct drm_evdi_wait_and_grab krequest;
+	int ret;
+
+	if (compat_copy_request(&req32, sizeof(req32), cmd, arg))
 		return -EFAULT;
-	return 0;
+
+	krequest.mode = req32.mode;
+	krequest.buf_width = req32.buf_width;
+	krequest.buf_height = req32.buf_height;
+	krequest.buf_byte_stride = req32.buf_byte_stride;
+	krequest.buffer = compat_ptr(req32.buffer_ptr32);
+	krequest.num_rects = req32.num_rects;
+	krequest.rects = compat_ptr(req32.rects_ptr32);
+	krequest.timeout_ms = req32.timeout_ms;
+	krequest.head = req32.head;
+
+	ret = drm_ioctl_kernel(file, evdi_painter_wait_and_grab_ioctl,
+			       &krequest, 0);
+	if (ret)
+		return ret;
+
+	req32.num_rects = krequest.num_rects;
+	return compat_copy_reply(arg, &req32, sizeof(req32), cmd);
 }
 
 static drm_ioctl_compat_t *evdi_compat_ioctls[] = {
 	[DRM_EVDI_CONNECT] = compat_evdi_connect,
 	[DRM_EVDI_GRABPIX] = compat_evdi_grabpix,
+	[DRM_EVDI_WAIT_AND_GRAB] = compat_evdi_wait_and_grab,
 };
 
 /*
@@ -25,16 +25,105 @@
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_plane_helper.h>
 #include <drm/drm_atomic_helper.h>
+#include <drm/drm_blend.h>
+#include <drm/drm_color_mgmt.h>
 #include "evdi_drm.h"
 #include "evdi_drm_drv.h"
 #include "evdi_cursor.h"
 #include "evdi_params.h"
+#include "evdi_damage.h"
+#include "evdi_color.h"
 #if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
 #include <drm/drm_gem_atomic_helper.h>
-#else
+#endif
 #include <drm/drm_gem_framebuffer_helper.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+
+struct evdi_crtc {
+	struct drm_crtc base;
+	struct evdi_head *head;
+	/* Emulates the vblank interrupt at the refresh rate of the mode */
+	struct hrtimer vblank_timer;
+	ktime_t vblank_period;
+	ktime_t vblank_time;
+
+	/* With variable refresh flips end a frame early, idle frames last long */
+	bool vrr_enabled;
+	ktime_t vrr_min_period;
+	ktime_t vrr_max_period;
+};
+
+#define to_evdi_crtc(x) container_of(x, struct evdi_crtc, base)
+
+/* Ends the current frame as soon as the shortest frame duration allows */
+static void evdi_crtc_vrr_flip(struct drm_crtc *crtc)
+{
+	struct evdi_crtc *evdi_crtc = to_evdi_crtc(crtc);
+	ktime_t now, next;
+
+	if (!READ_ONCE(evdi_crtc->vrr_enabled) ||
+	    !hrtimer_active(&evdi_crtc->vblank_timer))
+		return;
+
+	now = ktime_get();
+	next = ktime_add(READ_ONCE(evdi_crtc->vblank_time),
+			 evdi_crtc->vrr_min_period);
+	hrtimer_start(&evdi_crtc->vblank_timer,
+		      ktime_before(next, now) ? now : next, HRTIMER_MODE_ABS);
+}
+
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+static void evdi_crtc_update_vrr(struct drm_crtc *crtc,
+				 struct drm_crtc_state *crtc_state)
+{
+	struct evdi_crtc *evdi_crtc = to_evdi_crtc(crtc);
+	const int refresh = drm_mode_vrefresh(&crtc_state->adjusted_mode);
+	unsigned int min_hz, max_hz;
+	bool enabled = crtc_state->vrr_enabled && refresh > 0 &&
+		       evdi_connector_vrr_range(evdi_crtc->head, &min_hz, &max_hz);
+
+	if (enabled) {
+		evdi_crtc->vrr_min_period =
+			ns_to_ktime(NSEC_PER_SEC / min_t(unsigned int, max_hz, refresh));
+		evdi_crtc->vrr_max_period = ns_to_ktime(NSEC_PER_SEC / min_hz);
+	}
+	WRITE_ONCE(evdi_crtc->vrr_enabled, enabled);
+}
 #endif
 
+static const struct drm_color_lut *evdi_crtc_lut(struct drm_property_blob *blob,
+						int *size)
+{
+	*size = blob ? blob->length / sizeof(struct drm_color_lut) : 0;
+	return blob ? blob->data : NULL;
+}
+
+/* Hands the color management of the new state to the painter */
+static void evdi_crtc_update_color(struct evdi_head *head,
+				   struct drm_crtc_state *crtc_state)
+{
+	const struct drm_color_lut *degamma, *gamma;
+	int degamma_size, gamma_size;
+	struct evdi_color *color;
+	struct drm_clip_rect rect;
+
+	degamma = evdi_crtc_lut(crtc_state->degamma_lut, &degamma_size);
+	gamma = evdi_crtc_lut(crtc_state->gamma_lut, &gamma_size);
+	color = evdi_color_create(degamma, degamma_size,
+				  crtc_state->ctm ? crtc_state->ctm->data : NULL,
+				  gamma, gamma_size);
+	if (IS_ERR(color)) {
+		EVDI_ERROR("Failed to set color management: %ld\n",
+			   PTR_ERR(color));
+		return;
+	}
+
+	evdi_painter_set_color(head->painter, color);
+	rect = evdi_painter_framebuffer_size(head->painter);
+	evdi_painter_mark_dirty(head, &rect);
+}
+
 static void evdi_crtc_dpms(__always_unused struct drm_crtc *crtc,
 			   __always_unused int mode)
 {
@@ -49,20 +138,65 @@ static void evdi_crtc_disable(__always_unused struct drm_crtc *crtc)
 
 static void evdi_crtc_destroy(struct drm_crtc *crtc)
 {
+	struct evdi_crtc *evdi_crtc = to_evdi_crtc(crtc);
+
 	EVDI_CHECKPT();
+	hrtimer_cancel(&evdi_crtc->vblank_timer);
 	drm_crtc_cleanup(crtc);
-	kfree(crtc);
+	kfree(evdi_crtc);
 }
 
-static void evdi_crtc_commit(__always_unused struct drm_crtc *crtc)
+static void evdi_crtc_commit(__maybe_unused struct drm_crtc *crtc)
 {
 	EVDI_CHECKPT();
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+	if (evdi_vblank_timer)
+		drm_crtc_vblank_on(crtc);
+#endif
 }
 
 static void evdi_crtc_set_nofb(__always_unused struct drm_crtc *crtc)
 {
 }
 
+/* Painter notifications of a commit, sent in order by the commit worker */
+struct evdi_commit_work {
+	struct work_struct work;
+	struct evdi_head *head;
+	struct drm_crtc *crtc;
+	struct drm_pending_vblank_event *event;
+	struct drm_display_mode mode;
+	bool notify_mode_changed;
+	bool notify_dpms;
+	int dpms_mode;
+	bool async;
+};
+
+static void evdi_commit_notify(struct evdi_commit_work *commit)
+{
+	struct evdi_head *head = commit->head;
+
+	if (commit->notify_mode_changed)
+		evdi_painter_mode_changed_notify(head, &commit->mode);
+
+	if (commit->notify_dpms)
+		evdi_painter_dpms_notify(head->painter, commit->dpms_mode);
+
+	evdi_painter_set_vblank(head->painter, commit->crtc, commit->event,
+				commit->async);
+	evdi_crtc_vrr_flip(commit->crtc);
+	evdi_painter_send_update_ready_if_needed(head->painter);
+}
+
+static void evdi_commit_work_fn(struct work_struct *work)
+{
+	struct evdi_commit_work *commit =
+		container_of(work, struct evdi_commit_work, work);
+
+	evdi_commit_notify(commit);
+	kfree(commit);
+}
+
 static void evdi_crtc_atomic_flush(
 	struct drm_crtc *crtc
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
@@ -78,31 +212,53 @@ static void evdi_crtc_atomic_flush(
 	struct drm_crtc_state *crtc_state = crtc->state;
 #endif
 	struct evdi_device *evdi = crtc->dev->dev_private;
-	bool notify_mode_changed = crtc_state->active &&
-				   (crtc_state->mode_changed || evdi_painter_needs_full_modeset(evdi->painter));
-	bool notify_dpms = crtc_state->active_changed || evdi_painter_needs_full_modeset(evdi->painter);
-
-	if (notify_mode_changed)
-		evdi_painter_mode_changed_notify(evdi, &crtc_state->adjusted_mode);
+	struct evdi_head *head = to_evdi_crtc(crtc)->head;
+	struct evdi_commit_work local = { };
+	struct evdi_commit_work *commit;
+
+	commit = kzalloc(sizeof(*commit), GFP_KERNEL);
+	if (!commit)
+		commit = &local;
+
+	commit->head = head;
+	commit->crtc = crtc;
+	commit->event = crtc_state->event;
+	commit->notify_mode_changed = crtc_state->active &&
+		(crtc_state->mode_changed || evdi_painter_needs_full_modeset(head->painter));
+	commit->notify_dpms = crtc_state->active_changed || evdi_painter_needs_full_modeset(head->painter);
+	commit->dpms_mode = crtc_state->active ? DRM_MODE_DPMS_ON : DRM_MODE_DPMS_OFF;
+	if (commit->notify_mode_changed)
+		drm_mode_copy(&commit->mode, &crtc_state->adjusted_mode);
+#if KERNEL_VERSION(5, 6, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	commit->async = crtc_state->async_flip;
+#endif
+	crtc_state->event = NULL;
+	if (crtc_state->color_mgmt_changed)
+		evdi_crtc_update_color(head, crtc_state);
+#if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
+	evdi_crtc_update_vrr(crtc, crtc_state);
+#endif
 
-	if (notify_dpms)
-		evdi_painter_dpms_notify(evdi->painter,
-			crtc_state->active ? DRM_MODE_DPMS_ON : DRM_MODE_DPMS_OFF);
+	if (commit == &local) {
+		/* Keeps the notifications in order with the queued commits */
+		flush_workqueue(evdi->commit_wq);
+		evdi_commit_notify(commit);
+		return;
+	}
 
-	evdi_painter_set_vblank(evdi->painter, crtc, crtc_state->event);
-	evdi_painter_send_update_ready_if_needed(evdi->painter);
-	crtc_state->event = NULL;
+	INIT_WORK(&commit->work, evdi_commit_work_fn);
+	queue_work(evdi->commit_wq, &commit->work);
 }
 
 #if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE || defined(EL8)
 #else
-static void evdi_mark_full_screen_dirty(struct evdi_device *evdi)
+static void evdi_mark_full_screen_dirty(struct evdi_head *head)
 {
 	const struct drm_clip_rect rect =
-		evdi_painter_framebuffer_size(evdi->painter);
+		evdi_painter_framebuffer_size(head->painter);
 
-	evdi_painter_mark_dirty(evdi, &rect);
-	evdi_painter_send_update_ready_if_needed(evdi->painter);
+	evdi_painter_mark_dirty(head, &rect);
+	evdi_painter_send_update_ready_if_needed(head->painter);
 }
 
 static int evdi_crtc_cursor_set(struct drm_crtc *crtc,
@@ -113,8 +269,7 @@ static int evdi_crtc_cursor_set(struct drm_crtc *crtc,
 				int32_t hot_x,
 				int32_t hot_y)
 {
-	struct drm_device *dev = crtc->dev;
-	struct evdi_device *evdi = dev->dev_private;
+	struct evdi_head *head = to_evdi_crtc(crtc)->head;
 	struct drm_gem_object *obj = NULL;
 	struct evdi_gem_object *eobj = NULL;
 	/*
@@ -141,7 +296,7 @@ static int evdi_crtc_cursor_set(struct drm_crtc *crtc,
 			EVDI_ERROR("Failed to lookup gem object.\n");
 	}
 
-	evdi_cursor_set(evdi->cursor,
+	evdi_cursor_set(head->cursor,
 			eobj, width, height, hot_x, hot_y,
 			format, stride);
 	#if KERNEL_VERSION(5, 9, 0) <= LINUX_VERSION_CODE || defined(EL8)
@@ -154,25 +309,24 @@ static int evdi_crtc_cursor_set(struct drm_crtc *crtc,
 	 * For now we don't care whether the application wanted the mouse set,
 	 * or not.
 	 */
-	if (evdi->cursor_events_enabled)
-		evdi_painter_send_cursor_set(evdi->painter, evdi->cursor);
+	if (head->cursor_events_enabled)
+		evdi_painter_send_cursor_set(head->painter, head->cursor);
 	else
-		evdi_mark_full_screen_dirty(evdi);
+		evdi_mark_full_screen_dirty(head);
 	return 0;
 }
 
 static int evdi_crtc_cursor_move(struct drm_crtc *crtc, int x, int y)
 {
-	struct drm_device *dev = crtc->dev;
-	struct evdi_device *evdi = dev->dev_private;
+	struct evdi_head *head = to_evdi_crtc(crtc)->head;
 
 	EVDI_CHECKPT();
-	evdi_cursor_move(evdi->cursor, x, y);
+	evdi_cursor_move(head->cursor, x, y);
 
-	if (evdi->cursor_events_enabled)
-		evdi_painter_send_cursor_move(evdi->painter, evdi->cursor);
+	if (head->cursor_events_enabled)
+		evdi_painter_send_cursor_move(head->painter, head->cursor);
 	else
-		evdi_mark_full_screen_dirty(evdi);
+		evdi_mark_full_screen_dirty(head);
 
 	return 0;
 }
@@ -187,14 +341,69 @@ static struct drm_crtc_helper_funcs evdi_helper_funcs = {
 	.disable        = evdi_crtc_disable
 };
 
+static enum hrtimer_restart evdi_crtc_vblank_timer(struct hrtimer *timer)
+{
+	struct evdi_crtc *evdi_crtc =
+		container_of(timer, struct evdi_crtc, vblank_timer);
+	const ktime_t period = READ_ONCE(evdi_crtc->vrr_enabled) ?
+		evdi_crtc->vrr_max_period : evdi_crtc->vblank_period;
+	u64 overrun;
+
+	WRITE_ONCE(evdi_crtc->vblank_time, hrtimer_get_expires(timer));
+	overrun = hrtimer_forward_now(timer, period);
+	if (overrun != 1)
+		EVDI_VERBOSE("Missed %llu vblanks\n", overrun - 1);
+
+	/* A flip may restart the timer just after vblank was disabled */
+	if (!drm_crtc_handle_vblank(&evdi_crtc->base))
+		return HRTIMER_NORESTART;
+
+	return HRTIMER_RESTART;
+}
+
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
-static int evdi_enable_vblank(__always_unused struct drm_crtc *crtc)
+static int evdi_enable_vblank(struct drm_crtc *crtc)
 {
-	return 1;
+	struct evdi_crtc *evdi_crtc = to_evdi_crtc(crtc);
+	struct drm_vblank_crtc *vblank =
+		&crtc->dev->vblank[drm_crtc_index(crtc)];
+
+	if (!evdi_vblank_timer)
+		return -EINVAL;
+
+	/* crtc->mode is the adjusted mode of the last commit */
+	drm_calc_timestamping_constants(crtc, &crtc->mode);
+	if (!vblank->framedur_ns)
+		return -EINVAL;
+
+	evdi_crtc->vblank_period = ns_to_ktime(vblank->framedur_ns);
+	WRITE_ONCE(evdi_crtc->vblank_time, ktime_get());
+	hrtimer_start(&evdi_crtc->vblank_timer, evdi_crtc->vblank_period,
+		      HRTIMER_MODE_REL);
+	return 0;
 }
 
-static void evdi_disable_vblank(__always_unused struct drm_crtc *crtc)
+static void evdi_disable_vblank(struct drm_crtc *crtc)
 {
+	hrtimer_cancel(&to_evdi_crtc(crtc)->vblank_timer);
+}
+
+static bool evdi_get_vblank_timestamp(struct drm_crtc *crtc,
+				      __always_unused int *max_error,
+				      ktime_t *vblank_time,
+				      __always_unused bool in_vblank_irq)
+{
+	struct evdi_crtc *evdi_crtc = to_evdi_crtc(crtc);
+	struct drm_vblank_crtc *vblank =
+		&crtc->dev->vblank[drm_crtc_index(crtc)];
+
+	if (!READ_ONCE(vblank->enabled)) {
+		*vblank_time = ktime_get();
+		return true;
+	}
+
+	*vblank_time = READ_ONCE(evdi_crtc->vblank_time);
+	return true;
 }
 #endif
 
@@ -211,12 +420,76 @@ static const struct drm_crtc_funcs evdi_crtc_funcs = {
 	.cursor_set2            = evdi_crtc_cursor_set,
 	.cursor_move            = evdi_crtc_cursor_move,
 #endif
+#if KERNEL_VERSION(5, 12, 0) <= LINUX_VERSION_CODE || defined(EL8)
+#else
+	.gamma_set              = drm_atomic_helper_legacy_gamma_set,
+#endif
 #if KERNEL_VERSION(5, 11, 0) <= LINUX_VERSION_CODE || defined(RPI) || defined(EL8)
 	.enable_vblank          = evdi_enable_vblank,
 	.disable_vblank         = evdi_disable_vblank,
+	.get_vblank_timestamp   = evdi_get_vblank_timestamp,
 #endif
 };
 
+/* Planes belong to a single head, found through the CRTC they are or were on */
+static struct evdi_head *evdi_plane_head(struct drm_plane_state *state,
+					 struct drm_plane_state *old_state)
+{
+	struct drm_crtc *crtc = state->crtc ? state->crtc : old_state->crtc;
+
+	return crtc ? to_evdi_crtc(crtc)->head : NULL;
+}
+
+/* The state a plane will have after the commit, in it or not */
+static const struct drm_plane_state *
+evdi_plane_state_in(struct drm_atomic_state *state, struct drm_plane *plane)
+{
+	const struct drm_plane_state *plane_state =
+		drm_atomic_get_new_plane_state(state, plane);
+
+	return plane_state ? plane_state : plane->state;
+}
+
+static int evdi_plane_atomic_check(struct drm_plane *plane,
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+				   struct drm_atomic_state *atom_state
+#else
+				   struct drm_plane_state *state
+#endif
+		)
+{
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	struct drm_plane_state *state = drm_atomic_get_new_plane_state(atom_state, plane);
+#endif
+	struct drm_plane *overlay;
+
+	if (!state->fb)
+		return 0;
+
+	/* Overlays are only composed over RGB8888 primaries */
+	if (state->crtc && !evdi_fb_is_rgb8888(state->fb->format->format)) {
+		drm_for_each_plane(overlay, plane->dev) {
+			const struct drm_plane_state *overlay_state;
+
+			if (overlay->type != DRM_PLANE_TYPE_OVERLAY)
+				continue;
+			overlay_state = evdi_plane_state_in(state->state, overlay);
+			if (overlay_state->crtc == state->crtc && overlay_state->fb)
+				return -EINVAL;
+		}
+	}
+
+	if (state->rotation == DRM_MODE_ROTATE_0)
+		return 0;
+
+	/* Rotated frames are gathered pixel by pixel from a single plane */
+	if (state->fb->format->num_planes > 1 ||
+	    to_evdi_fb(state->fb)->is_from_xe)
+		return -EINVAL;
+
+	return 0;
+}
+
 static void evdi_plane_atomic_update(struct drm_plane *plane,
 #if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
 				     struct drm_atomic_state *atom_state
@@ -230,7 +503,7 @@ static void evdi_plane_atomic_update(struct drm_plane *plane,
 #else
 #endif
 	struct drm_plane_state *state;
-	struct evdi_device *evdi;
+	struct evdi_head *head;
 	struct evdi_painter *painter;
 	struct drm_crtc *crtc;
 
@@ -251,14 +524,16 @@ static void evdi_plane_atomic_update(struct drm_plane *plane,
 	}
 
 	state = plane->state;
-	evdi = plane->dev->dev_private;
-	painter = evdi->painter;
+	head = evdi_plane_head(state, old_state);
+	if (!head)
+		return;
+	painter = head->painter;
 	crtc = state->crtc;
 
 	if (!old_state->crtc && state->crtc)
-		evdi_painter_dpms_notify(evdi->painter, DRM_MODE_DPMS_ON);
+		evdi_painter_dpms_notify(painter, DRM_MODE_DPMS_ON);
 	else if (old_state->crtc && !state->crtc)
-		evdi_painter_dpms_notify(evdi->painter, DRM_MODE_DPMS_OFF);
+		evdi_painter_dpms_notify(painter, DRM_MODE_DPMS_OFF);
 
 	if (state->fb) {
 		struct drm_framebuffer *fb = state->fb;
@@ -268,6 +543,8 @@ static void evdi_plane_atomic_update(struct drm_plane *plane,
 		const struct drm_clip_rect fullscreen_rect = {
 			0, 0, fb->width, fb->height
 		};
+		struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+		int num_rects = 0;
 
 		if (!old_fb && crtc)
 			evdi_painter_force_full_modeset(painter);
@@ -277,10 +554,11 @@ static void evdi_plane_atomic_update(struct drm_plane *plane,
 		    fb->format->format != old_fb->format->format)
 			evdi_painter_force_full_modeset(painter);
 
-		if (fb != old_fb ||
+		if (fb != old_fb || state->rotation != old_state->rotation ||
 		    evdi_painter_needs_full_modeset(painter)) {
 
-			evdi_painter_set_scanout_buffer(painter, efb);
+			evdi_painter_set_scanout_buffer(painter, efb,
+							state->rotation);
 
 #if KERNEL_VERSION(5, 0, 0) <= LINUX_VERSION_CODE || defined(EL8)
 			state->visible = true;
@@ -295,14 +573,23 @@ static void evdi_plane_atomic_update(struct drm_plane *plane,
 				clip_rect.y1 = rect.y1;
 				clip_rect.x2 = rect.x2;
 				clip_rect.y2 = rect.y2;
-				evdi_painter_mark_dirty(evdi, &clip_rect);
+				if (num_rects < EVDI_DAMAGE_MAX_RECTS)
+					rects[num_rects++] = clip_rect;
+				else
+					evdi_damage_expand_rect(&rects[num_rects - 1],
+								&clip_rect);
 			}
 #endif
 
 		};
 
-		if (evdi_painter_get_num_dirts(painter) == 0)
-			evdi_painter_mark_dirty(evdi, &fullscreen_rect);
+		if ((num_rects == 0 && evdi_painter_get_num_dirts(painter) == 0) ||
+		    state->rotation != old_state->rotation) {
+			rects[0] = fullscreen_rect;
+			num_rects = 1;
+		}
+
+		evdi_painter_mark_fb_dirty(head, efb, rects, num_rects);
 	}
 }
 
@@ -328,9 +615,10 @@ static void evdi_cursor_atomic_update(struct drm_plane *plane,
 
 #else
 #endif
-	if (plane && plane->state && plane->dev && plane->dev->dev_private) {
+	if (plane && plane->state && plane->dev && plane->dev->dev_private &&
+	    evdi_plane_head(plane->state, old_state)) {
 		struct drm_plane_state *state = plane->state;
-		struct evdi_device *evdi = plane->dev->dev_private;
+		struct evdi_head *head = evdi_plane_head(state, old_state);
 		struct drm_framebuffer *fb = state->fb;
 		struct evdi_framebuffer *efb = to_evdi_fb(fb);
 
@@ -341,9 +629,9 @@ static void evdi_cursor_atomic_update(struct drm_plane *plane,
 		int32_t cursor_position_x = 0;
 		int32_t cursor_position_y = 0;
 
-		evdi_cursor_position(evdi->cursor, &cursor_position_x,
+		evdi_cursor_position(head->cursor, &cursor_position_x,
 		&cursor_position_y);
-		evdi_cursor_move(evdi->cursor, state->crtc_x, state->crtc_y);
+		evdi_cursor_move(head->cursor, state->crtc_x, state->crtc_y);
 		cursor_position_changed = cursor_position_x != state->crtc_x ||
 					  cursor_position_y != state->crtc_y;
 
@@ -351,7 +639,7 @@ static void evdi_cursor_atomic_update(struct drm_plane *plane,
 			if (fb != NULL) {
 				uint32_t stride = 4 * fb->width;
 
-				evdi_cursor_set(evdi->cursor,
+				evdi_cursor_set(head->cursor,
 						efb->obj,
 						fb->width,
 						fb->height,
@@ -361,36 +649,174 @@ static void evdi_cursor_atomic_update(struct drm_plane *plane,
 						stride);
 			}
 
-			evdi_cursor_enable(evdi->cursor, fb != NULL);
+			evdi_cursor_enable(head->cursor, fb != NULL);
 			cursor_changed = true;
 		}
 
-		if (!evdi->cursor_events_enabled) {
+		if (!head->cursor_events_enabled) {
 			if (fb != NULL) {
 				if (efb->obj->allow_sw_cursor_rect_updates) {
 					evdi_cursor_atomic_get_rect(&old_rect, old_state);
 					evdi_cursor_atomic_get_rect(&rect, state);
 
-					evdi_painter_mark_dirty(evdi, &old_rect);
+					evdi_painter_mark_dirty(head, &old_rect);
 				} else {
-					rect = evdi_painter_framebuffer_size(evdi->painter);
+					rect = evdi_painter_framebuffer_size(head->painter);
 				}
-				evdi_painter_mark_dirty(evdi, &rect);
+				evdi_painter_mark_dirty(head, &rect);
 			}
 			return;
 		}
 
 		if (cursor_changed)
-			evdi_painter_send_cursor_set(evdi->painter,
-						     evdi->cursor);
+			evdi_painter_send_cursor_set(head->painter,
+						     head->cursor);
 		if (cursor_position_changed)
-			evdi_painter_send_cursor_move(evdi->painter,
-						      evdi->cursor);
+			evdi_painter_send_cursor_move(head->painter,
+						      head->cursor);
 	}
 }
 
+static int evdi_overlay_index(struct evdi_head *head, struct drm_plane *plane)
+{
+	unsigned int i;
+
+	for (i = 0; i < head->num_overlays; ++i)
+		if (head->overlays[i] == plane)
+			return i;
+	return -1;
+}
+
+static void evdi_overlay_get_rect(struct drm_clip_rect *rect,
+				  struct drm_plane_state *state)
+{
+	rect->x1 = max(state->crtc_x, 0);
+	rect->y1 = max(state->crtc_y, 0);
+	rect->x2 = max_t(int, state->crtc_x + (int)state->crtc_w, 0);
+	rect->y2 = max_t(int, state->crtc_y + (int)state->crtc_h, 0);
+}
+
+/*
+ * Overlays are copied over the primary plane row by row at grab time, so
+ * they are neither scaled nor placed at fractional source coordinates.
+ */
+static int evdi_overlay_atomic_check(struct drm_plane *plane,
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+				     struct drm_atomic_state *atom_state
+#else
+				     struct drm_plane_state *state
+#endif
+		)
+{
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	struct drm_plane_state *state = drm_atomic_get_new_plane_state(atom_state, plane);
+#endif
+	const struct drm_plane_state *primary;
+
+	if (!state->fb || !state->crtc)
+		return 0;
+
+	if (to_evdi_fb(state->fb)->is_from_xe)
+		return -EINVAL;
+
+	if ((state->src_x | state->src_y | state->src_w | state->src_h) & 0xffff)
+		return -EINVAL;
+
+	if (state->src_w >> 16 != state->crtc_w ||
+	    state->src_h >> 16 != state->crtc_h)
+		return -EINVAL;
+
+	/* The painter drops overlays over other primary formats */
+	primary = evdi_plane_state_in(state->state, state->crtc->primary);
+	if (primary->crtc == state->crtc && primary->fb &&
+	    !evdi_fb_is_rgb8888(primary->fb->format->format))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void evdi_overlay_atomic_update(struct drm_plane *plane,
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+				       struct drm_atomic_state *atom_state
+#else
+				       struct drm_plane_state *old_state
+#endif
+		)
+{
+#if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	struct drm_plane_state *old_state = drm_atomic_get_old_plane_state(atom_state, plane);
+#endif
+	struct drm_plane_state *state = plane->state;
+	struct evdi_overlay overlay = { };
+	struct drm_clip_rect rect;
+	struct evdi_head *head;
+	int index;
+
+	head = evdi_plane_head(state, old_state);
+	if (!head)
+		return;
+	index = evdi_overlay_index(head, plane);
+	if (index < 0)
+		return;
+
+	if (state->fb && state->crtc) {
+		overlay.efb = to_evdi_fb(state->fb);
+		overlay.src_x = state->src_x >> 16;
+		overlay.src_y = state->src_y >> 16;
+		overlay.dst.x1 = state->crtc_x;
+		overlay.dst.y1 = state->crtc_y;
+		overlay.dst.x2 = state->crtc_x + state->crtc_w;
+		overlay.dst.y2 = state->crtc_y + state->crtc_h;
+	}
+	evdi_painter_set_overlay(head->painter, index, &overlay);
+
+	/* Whatever the overlay covered before and covers now is redrawn */
+	if (old_state->fb && old_state->crtc) {
+		evdi_overlay_get_rect(&rect, old_state);
+		evdi_painter_mark_dirty(head, &rect);
+	}
+	if (overlay.efb) {
+		evdi_overlay_get_rect(&rect, state);
+		evdi_painter_mark_dirty(head, &rect);
+	}
+}
+
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+/*
+ * Commits do not wait for rendering to an imported primary buffer to
+ * complete. The painter publishes its damage once the fence signals.
+ */
+static int evdi_plane_prepare_fb(struct drm_plane *plane,
+				 struct drm_plane_state *state)
+{
+	struct drm_gem_object *obj;
+
+	if (!state->fb)
+		return 0;
+
+	obj = drm_gem_fb_get_obj(state->fb, 0);
+	if (obj && obj->import_attach)
+		return 0;
+
+	return drm_gem_plane_helper_prepare_fb(plane, state);
+}
+#endif
+
 static const struct drm_plane_helper_funcs evdi_plane_helper_funcs = {
+	.atomic_check = evdi_plane_atomic_check,
 	.atomic_update = evdi_plane_atomic_update,
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+	.prepare_fb = evdi_plane_prepare_fb
+#elif KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	.prepare_fb = drm_gem_plane_helper_prepare_fb
+#else
+	.prepare_fb = drm_gem_fb_prepare_fb
+#endif
+};
+
+static const struct drm_plane_helper_funcs evdi_overlay_helper_funcs = {
+	.atomic_check = evdi_overlay_atomic_check,
+	.atomic_update = evdi_overlay_atomic_update,
 #if KERNEL_VERSION(5, 13, 0) <= LINUX_VERSION_CODE || defined(EL8)
 	.prepare_fb = drm_gem_plane_helper_prepare_fb
 #else
@@ -421,16 +847,38 @@ static const uint32_t formats[] = {
 	DRM_FORMAT_ARGB8888,
 	DRM_FORMAT_XBGR8888,
 	DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_XRGB2101010,
+	DRM_FORMAT_NV12,
+};
+
+/* The cursor is blended from 32 bpp pixels */
+static const uint32_t cursor_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_ABGR8888,
+};
+
+/* Overlays are opaque, pixels are copied without blending */
+static const uint32_t overlay_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_XBGR8888,
 };
 
 static struct drm_plane *evdi_create_plane(
 		struct drm_device *dev,
+		uint32_t possible_crtcs,
 		enum drm_plane_type type,
 		const struct drm_plane_helper_funcs *helper_funcs)
 {
+	const bool is_overlay = type == DRM_PLANE_TYPE_OVERLAY;
+	const uint32_t *plane_formats = formats;
+	unsigned int num_formats = ARRAY_SIZE(formats);
 	struct drm_plane *plane;
 	int ret;
-	char *plane_type = (type == DRM_PLANE_TYPE_CURSOR) ? "cursor" : "primary";
+	char *plane_type = (type == DRM_PLANE_TYPE_CURSOR) ? "cursor" :
+			   is_overlay ? "overlay" : "primary";
 
 	plane = kzalloc(sizeof(*plane), GFP_KERNEL);
 	if (plane == NULL) {
@@ -439,12 +887,20 @@ static struct drm_plane *evdi_create_plane(
 	}
 	plane->format_default = true;
 
+	if (type == DRM_PLANE_TYPE_CURSOR) {
+		plane_formats = cursor_formats;
+		num_formats = ARRAY_SIZE(cursor_formats);
+	} else if (is_overlay) {
+		plane_formats = overlay_formats;
+		num_formats = ARRAY_SIZE(overlay_formats);
+	}
+
 	ret = drm_universal_plane_init(dev,
 				       plane,
-				       0xFF,
+				       possible_crtcs,
 				       &evdi_plane_funcs,
-				       formats,
-				       ARRAY_SIZE(formats),
+				       plane_formats,
+				       num_formats,
 				       NULL,
 				       type,
 				       NULL
@@ -461,30 +917,65 @@ static struct drm_plane *evdi_create_plane(
 	return plane;
 }
 
-static int evdi_crtc_init(struct drm_device *dev)
+static int evdi_crtc_init(struct drm_device *dev, struct evdi_head *head)
 {
+	struct evdi_crtc *evdi_crtc = NULL;
 	struct drm_crtc *crtc = NULL;
 	struct drm_plane *primary_plane = NULL;
 	struct drm_plane *cursor_plane = NULL;
+	unsigned int i;
 	int status = 0;
 
 	EVDI_CHECKPT();
-	crtc = kzalloc(sizeof(struct drm_crtc), GFP_KERNEL);
-	if (crtc == NULL)
+	evdi_crtc = kzalloc(sizeof(struct evdi_crtc), GFP_KERNEL);
+	if (evdi_crtc == NULL)
 		return -ENOMEM;
+	crtc = &evdi_crtc->base;
+	evdi_crtc->head = head;
+
+#if KERNEL_VERSION(6, 13, 0) <= LINUX_VERSION_CODE
+	hrtimer_setup(&evdi_crtc->vblank_timer, evdi_crtc_vblank_timer,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&evdi_crtc->vblank_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	evdi_crtc->vblank_timer.function = evdi_crtc_vblank_timer;
+#endif
 
-	primary_plane = evdi_create_plane(dev, DRM_PLANE_TYPE_PRIMARY,
+	primary_plane = evdi_create_plane(dev, BIT(head->index),
+					  DRM_PLANE_TYPE_PRIMARY,
 					  &evdi_plane_helper_funcs);
 
 #if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE || defined(EL8)
-	cursor_plane = evdi_create_plane(dev, DRM_PLANE_TYPE_CURSOR,
-						&evdi_cursor_helper_funcs);
+	cursor_plane = evdi_create_plane(dev, BIT(head->index),
+					 DRM_PLANE_TYPE_CURSOR,
+					 &evdi_cursor_helper_funcs);
 #endif
 
 #if KERNEL_VERSION(5, 0, 0) <= LINUX_VERSION_CODE || defined(EL8)
 	drm_plane_enable_fb_damage_clips(primary_plane);
 #endif
 
+	/* Overlays stack in index order between the primary and the cursor */
+	for (i = 0; i < head->num_overlays; ++i) {
+		head->overlays[i] = evdi_create_plane(dev, BIT(head->index),
+						      DRM_PLANE_TYPE_OVERLAY,
+						      &evdi_overlay_helper_funcs);
+		if (head->overlays[i])
+			drm_plane_create_zpos_immutable_property(head->overlays[i],
+								 i + 1);
+	}
+	if (primary_plane) {
+		drm_plane_create_zpos_immutable_property(primary_plane, 0);
+		drm_plane_create_rotation_property(primary_plane,
+						   DRM_MODE_ROTATE_0,
+						   DRM_MODE_ROTATE_MASK |
+						   DRM_MODE_REFLECT_MASK);
+	}
+	if (cursor_plane)
+		drm_plane_create_zpos_immutable_property(cursor_plane,
+							 head->num_overlays + 1);
+
 	status = drm_crtc_init_with_planes(dev, crtc,
 					   primary_plane, cursor_plane,
 					   &evdi_crtc_funcs,
@@ -494,9 +985,35 @@ static int evdi_crtc_init(struct drm_device *dev)
 	EVDI_DEBUG("drm_crtc_init: %d p%p\n", status, primary_plane);
 	drm_crtc_helper_add(crtc, &evdi_helper_funcs);
 
+	/* Legacy gamma ramps are turned into a GAMMA_LUT by the core */
+	drm_mode_crtc_set_gamma_size(crtc, 256);
+	drm_crtc_enable_color_mgmt(crtc, EVDI_COLOR_LUT_SIZE, true,
+				   EVDI_COLOR_LUT_SIZE);
+	head->crtc = crtc;
+
 	return 0;
 }
 
+/*
+ * Painter notifications and flip events are left to the commit worker of
+ * the device, so the tail only updates the state. Nothing waits for a
+ * vblank, as the painter holds its own reference to the scanout buffer.
+ */
+static void evdi_atomic_commit_tail(struct drm_atomic_state *state)
+{
+	struct drm_device *dev = state->dev;
+
+	drm_atomic_helper_commit_modeset_disables(dev, state);
+	drm_atomic_helper_commit_planes(dev, state, 0);
+	drm_atomic_helper_commit_modeset_enables(dev, state);
+	drm_atomic_helper_commit_hw_done(state);
+	drm_atomic_helper_cleanup_planes(dev, state);
+}
+
+static const struct drm_mode_config_helper_funcs evdi_mode_config_helpers = {
+	.atomic_commit_tail = evdi_atomic_commit_tail,
+};
+
 static const struct drm_mode_config_funcs evdi_mode_funcs = {
 	.fb_create = evdi_fb_user_fb_create,
 #if KERNEL_VERSION(6, 11, 0) < LINUX_VERSION_CODE || defined(EL9)
@@ -509,7 +1026,9 @@ static const struct drm_mode_config_funcs evdi_mode_funcs = {
 
 void evdi_modeset_init(struct drm_device *dev)
 {
+	struct evdi_device *evdi = dev->dev_private;
 	struct drm_encoder *encoder;
+	unsigned int i;
 
 	EVDI_CHECKPT();
 
@@ -525,12 +1044,22 @@ void evdi_modeset_init(struct drm_device *dev)
 	dev->mode_config.preferred_depth = 24;
 
 	dev->mode_config.funcs = &evdi_mode_funcs;
+	dev->mode_config.helper_private = &evdi_mode_config_helpers;
+#if KERNEL_VERSION(5, 6, 0) <= LINUX_VERSION_CODE || defined(EL8)
+	dev->mode_config.async_page_flip = true;
+#endif
 
-	evdi_crtc_init(dev);
+	/* CRTC indices, and so vblank pipes, follow the head indices */
+	for (i = 0; i < evdi->num_heads; ++i) {
+		evdi_crtc_init(dev, &evdi->heads[i]);
 
-	encoder = evdi_encoder_init(dev);
+		encoder = evdi_encoder_init(dev, i);
 
-	evdi_connector_init(dev, encoder);
+		evdi_connector_init(dev, encoder, &evdi->heads[i]);
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+		evdi_writeback_init(dev, &evdi->heads[i]);
+#endif
+	}
 
 	drm_mode_config_reset(dev);
 }
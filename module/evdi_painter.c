@@ -20,6 +20,7 @@
 #include <drm/drmP.h>
 #endif
 #include <drm/drm_edid.h>
+#include <drm/drm_blend.h>
 #if defined(CONFIG_X86)
 #include <drm/drm_cache.h>
 #endif
@@ -28,15 +29,23 @@
 #include "evdi_cursor.h"
 #include "evdi_params.h"
 #include "evdi_i2c.h"
+#include "evdi_damage.h"
+#include "evdi_color.h"
 #include <linux/mutex.h>
 #include <linux/compiler.h>
 #include <linux/platform_device.h>
 #include <linux/completion.h>
 #include <linux/ktime.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/dma-buf.h>
+#include <linux/dma-fence.h>
+#include <linux/dma-resv.h>
 #include <linux/vt_kern.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/wait_bit.h>
+#include <linux/workqueue.h>
 #if KERNEL_VERSION(5, 4, 0) <= LINUX_VERSION_CODE || defined(EL8)
 #include <linux/compiler_attributes.h>
 #endif
@@ -92,27 +101,55 @@ struct evdi_event_ddcci_data_pending {
 #define MAX_EDID_SIZE (255 * EDID_EXT_BLOCK_SIZE + sizeof(struct edid))
 #define I2C_ADDRESS_DDCCI 0x37
 #define DDCCI_TIMEOUT_MS 50
+#define RENDER_FENCE_TIMEOUT_MS 100
 
 struct evdi_painter {
+	struct evdi_head *head;
 	bool is_connected;
 	struct edid *edid;
 	unsigned int edid_length;
 
 	struct mutex lock;
-	struct drm_clip_rect dirty_rects[MAX_DIRTS];
-	int num_dirts;
+	struct evdi_damage damage;
+	wait_queue_head_t damage_wait;
 	struct evdi_framebuffer *scanout_fb;
+	/* Rotation of the primary plane, damage is kept rotated to match */
+	unsigned int rotation;
+	struct evdi_overlay overlays[EVDI_MAX_OVERLAYS];
+	/* Color management of the CRTC, NULL when it is the identity */
+	struct evdi_color *color;
 
 	struct drm_file *drm_filp;
 	struct drm_device *drm_device;
 
-	bool was_update_requested;
+	atomic_t was_update_requested;
 	bool needs_full_modeset;
+
+	/* Damage waiting for rendering to imported buffers to complete */
+	atomic_t fences_pending;
+	/* Waiters whose fence callback may not have fired, under fence_lock */
+	struct list_head fence_waiters;
+	spinlock_t fence_lock;
+
+	/* Protects the held vblank and taking damage for a grab */
+	spinlock_t vblank_lock;
 	struct drm_crtc *crtc;
 	struct drm_pending_vblank_event *vblank;
+	ktime_t vblank_held_since;
+	u64 vblanks_held;
+	u64 vblanks_timed_out;
+	u64 vblank_held_ns_total;
+	u64 vblank_held_ns_max;
+
+	/* Sends a held vblank once the flip timeout of the device passes */
+	struct delayed_work vblank_timeout_work;
 
 	struct list_head pending_events;
 	struct delayed_work send_events_work;
+	u32 event_mask;
+
+	/* Releases buffer mappings once the display stays off */
+	struct delayed_work release_work;
 
 	struct completion ddcci_response_received;
 	char *ddcci_buffer;
@@ -121,119 +158,213 @@ struct evdi_painter {
 	int fg_console;
 #if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
 	struct dentry *debugfs_measure_copy;
+	struct dentry *debugfs_root;
 #endif
 };
 
-static void expand_rect(struct drm_clip_rect *a, const struct drm_clip_rect *b)
+int evdi_pixel_dst_write(const struct evdi_pixel_dst *dst, long offset,
+			 const void *src, unsigned long len)
 {
-	a->x1 = min(a->x1, b->x1);
-	a->y1 = min(a->y1, b->y1);
-	a->x2 = max(a->x2, b->x2);
-	a->y2 = max(a->y2, b->y2);
-}
-
-static int rect_area(const struct drm_clip_rect *r)
-{
-	return (r->x2 - r->x1) * (r->y2 - r->y1);
+	if (dst->kernel) {
+		memcpy(dst->kernel + offset, src, len);
+		return 0;
+	}
+	return copy_to_user(dst->user + offset, src, len) ? -EFAULT : 0;
 }
 
-static void merge_dirty_rects(struct drm_clip_rect *rects, int *count)
+#if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
+static int copy_primary_pixels_on_xe(struct evdi_framebuffer *efb,
+			       const struct evdi_color *color,
+			       const struct evdi_pixel_dst *dst,
+			       int const max_x,
+			       int const max_y)
 {
-	int a, b;
-
-	for (a = 0; a < *count - 1; ++a) {
-		for (b = a + 1; b < *count;) {
-			/* collapse to bounding rect if it is fewer pixels */
-			const int area_a = rect_area(&rects[a]);
-			const int area_b = rect_area(&rects[b]);
-			struct drm_clip_rect bounding_rect = rects[a];
-
-			expand_rect(&bounding_rect, &rects[b]);
-
-			if (rect_area(&bounding_rect) <= area_a + area_b) {
-				rects[a] = bounding_rect;
-				rects[b] = rects[*count - 1];
-				/* repass */
-				b = a + 1;
-				--*count;
-			} else {
-				++b;
-			}
+	int y, plane;
+	struct drm_framebuffer *fb = &efb->base;
+	const int byte_span = max_x * fb->format->cpp[0];
+	struct iosys_map dst_mapping = IOSYS_MAP_INIT_VADDR(vmalloc(byte_span));
+	int row = 0;
+
+	/* Rows of a chroma plane follow the rows of the plane before */
+	for (plane = 0; plane < fb->format->num_planes; ++plane) {
+		const int rows = plane ? DIV_ROUND_UP(max_y, fb->format->vsub) : max_y;
+		const int span = plane ? DIV_ROUND_UP(max_x, fb->format->hsub) *
+					 fb->format->cpp[plane] : byte_span;
+
+		for (y = 0; y < rows; ++y) {
+			const int src_offset = fb->offsets[plane] + fb->pitches[plane] * y;
+			struct iosys_map src_mapping = IOSYS_MAP_INIT_VADDR((char *)efb->obj->vmapping + src_offset);
+			const int dst_offset = dst->stride * (row + y);
+
+			drm_clflush_virt_range(src_mapping.vaddr, span);
+			drm_memcpy_from_wc(&dst_mapping, &src_mapping, span);
+			if (!plane)
+				evdi_color_apply_row(color, fb->format->format,
+						     dst_mapping.vaddr, max_x);
+			if (evdi_pixel_dst_write(dst, dst_offset,
+						 dst_mapping.vaddr, span))
+				return -EFAULT;
 		}
+		row += rows;
 	}
+
+	vfree(dst_mapping.vaddr);
+	return 0;
+
 }
+#endif
 
-static void collapse_dirty_rects(struct drm_clip_rect *rects, int *count)
+static int copy_plane_rows(const char *src, unsigned int src_pitch,
+			   const struct evdi_pixel_dst *dst, long dst_offset,
+			   int byte_span, int y, bool full_width)
 {
-	int i;
+	/* Full width rows of equal pitch are one contiguous block */
+	if (y > 0 && full_width && src_pitch == (unsigned int)dst->stride) {
+		const unsigned long len =
+			(unsigned long)src_pitch * (y - 1) + byte_span;
 
-	EVDI_VERBOSE("Not enough space for rects. They will be collapsed");
+#if defined(CONFIG_X86)
+		drm_clflush_virt_range((void *)src, len);
+#endif
+		return evdi_pixel_dst_write(dst, dst_offset, src, len);
+	}
+
+	for (; y > 0; --y) {
+#if defined(CONFIG_X86)
+		drm_clflush_virt_range((void *)src, byte_span);
+#endif
+		if (evdi_pixel_dst_write(dst, dst_offset, src, byte_span))
+			return -EFAULT;
 
-	for (i = 1; i < *count; ++i)
-		expand_rect(&rects[0], &rects[i]);
+		src += src_pitch;
+		dst_offset += dst->stride;
+	}
 
-	*count = 1;
+	return 0;
 }
 
-#if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
-static int copy_primary_pixels_on_xe(struct evdi_framebuffer *efb,
-			       char __user *buffer,
-			       int buf_byte_stride,
+/*
+ * Gathers each row of the rotated output from the framebuffer pixels the
+ * rotation maps to it, so the buffer receives the frame as shown on the
+ * CRTC. Rows pass through color management on the way. Rotation and color
+ * management are limited to single plane formats.
+ */
+static int copy_rotated_pixels(struct evdi_framebuffer *efb,
+			       unsigned int rotation,
+			       const struct evdi_color *color,
+			       const struct evdi_pixel_dst *dst,
+			       int num_rects, struct drm_clip_rect *rects,
 			       int const max_x,
 			       int const max_y)
 {
-	int y;
 	struct drm_framebuffer *fb = &efb->base;
-	const int byte_span = max_x * 4;
-	struct iosys_map dst_mapping = IOSYS_MAP_INIT_VADDR(vmalloc(max_x * 4));
-
-	for (y = 0; y < max_y; ++y) {
-		const int src_offset = fb->offsets[0] + fb->pitches[0] * y;
-		struct iosys_map src_mapping = IOSYS_MAP_INIT_VADDR((char *)efb->obj->vmapping + src_offset);
-		const int dst_offset = buf_byte_stride * y;
-		char __user *dst = buffer + dst_offset;
-
-		drm_clflush_virt_range(src_mapping.vaddr, byte_span);
-		drm_memcpy_from_wc(&dst_mapping, &src_mapping, byte_span);
-		if (copy_to_user(dst, dst_mapping.vaddr, byte_span))
-			return -EFAULT;
+	const int cpp = fb->format->cpp[0];
+	const char *pixels = (char *)efb->obj->vmapping + fb->offsets[0];
+	struct drm_clip_rect *r;
+	char *row;
+	int err = 0;
 
-		src_mapping.vaddr += fb->pitches[0];
-		dst += buf_byte_stride;
-	}
+	row = kmalloc_array(max_x, cpp, GFP_KERNEL);
+	if (!row)
+		return -ENOMEM;
 
-	vfree(dst_mapping.vaddr);
-	return 0;
+	for (r = rects; r != rects + num_rects && !err; ++r) {
+#if defined(CONFIG_X86)
+		struct drm_rect src_rect = { r->x1, r->y1, r->x2, r->y2 };
+#endif
+		int x, y;
 
-}
+		if (max_x < r->x2 || max_y < r->y2) {
+			EVDI_WARN("Rect size beyond expected dimensions\n");
+			err = -EFAULT;
+			break;
+		}
+
+#if defined(CONFIG_X86)
+		drm_rect_rotate_inv(&src_rect, fb->width, fb->height, rotation);
+		for (y = src_rect.y1; y < src_rect.y2; ++y)
+			drm_clflush_virt_range((void *)(pixels + fb->pitches[0] * y +
+							cpp * src_rect.x1),
+					       cpp * drm_rect_width(&src_rect));
 #endif
 
+		for (y = r->y1; y < r->y2; ++y) {
+			int first_x = r->x1, first_y = y;
+			int next_x = r->x1 + 1, next_y = y;
+			const char *src;
+			long step;
+
+			evdi_fb_unrotate_point(fb, rotation, &first_x, &first_y);
+			evdi_fb_unrotate_point(fb, rotation, &next_x, &next_y);
+			src = pixels + fb->pitches[0] * first_y + cpp * first_x;
+			step = (long)fb->pitches[0] * (next_y - first_y) +
+			       cpp * (next_x - first_x);
+
+			for (x = 0; x < r->x2 - r->x1 && step != cpp; ++x) {
+				if (cpp == 4)
+					((uint32_t *)row)[x] =
+						*(const uint32_t *)(src + x * step);
+				else if (cpp == 2)
+					((uint16_t *)row)[x] =
+						*(const uint16_t *)(src + x * step);
+				else
+					memcpy(row + x * cpp, src + x * step, cpp);
+			}
+			if (step == cpp)
+				memcpy(row, src, cpp * (r->x2 - r->x1));
+			evdi_color_apply_row(color, fb->format->format, row,
+					     r->x2 - r->x1);
+
+			if (evdi_pixel_dst_write(dst, (long)dst->stride * y + cpp * r->x1,
+						 row, cpp * (r->x2 - r->x1))) {
+				err = -EFAULT;
+				break;
+			}
+		}
+	}
+
+	kfree(row);
+	return err;
+}
+
+/*
+ * Pixels are copied in the format of the framebuffer. The chroma plane of
+ * NV12 follows the luma rows in the buffer, with the same stride.
+ */
 static int copy_primary_pixels(struct evdi_framebuffer *efb,
-			       char __user *buffer,
-			       int buf_byte_stride,
+			       unsigned int rotation,
+			       const struct evdi_color *color,
+			       const struct evdi_pixel_dst *dst,
 			       int num_rects, struct drm_clip_rect *rects,
 			       int const max_x,
 			       int const max_y)
 {
 	struct drm_framebuffer *fb = &efb->base;
+	const struct drm_format_info *format = fb->format;
 	struct drm_clip_rect *r;
+	int err;
 
 	EVDI_CHECKPT();
 
 #if KERNEL_VERSION(5, 18, 0) <= LINUX_VERSION_CODE || defined(EL8) || defined(EL9)
 	if (efb->is_from_xe)
-		return copy_primary_pixels_on_xe(efb, buffer, buf_byte_stride, max_x, max_y);
+		return copy_primary_pixels_on_xe(efb, color, dst, max_x, max_y);
 #endif
 
+	if (rotation != DRM_MODE_ROTATE_0 || (color && format->num_planes == 1))
+		return copy_rotated_pixels(efb, rotation, color, dst,
+					   num_rects, rects,
+					   max_x, max_y);
+
 	for (r = rects; r != rects + num_rects; ++r) {
-		const int byte_offset = r->x1 * 4;
-		const int byte_span = (r->x2 - r->x1) * 4;
+		const bool full_width = r->x1 == 0 && r->x2 == max_x;
+		const int byte_offset = r->x1 * format->cpp[0];
+		const int byte_span = (r->x2 - r->x1) * format->cpp[0];
 		const int src_offset = fb->offsets[0] +
 				       fb->pitches[0] * r->y1 + byte_offset;
 		const char *src = (char *)efb->obj->vmapping + src_offset;
-		const int dst_offset = buf_byte_stride * r->y1 + byte_offset;
-		char __user *dst = buffer + dst_offset;
-		int y = r->y2 - r->y1;
+		const long dst_offset = (long)dst->stride * r->y1 + byte_offset;
+		int x1, x2, y1, y2;
 
 		/* rect size may correspond to previous resolution */
 		if (max_x < r->x2 || max_y < r->y2) {
@@ -244,31 +375,168 @@ static int copy_primary_pixels(struct evdi_framebuffer *efb,
 		EVDI_VERBOSE("copy rect %d,%d-%d,%d\n", r->x1, r->y1, r->x2,
 			     r->y2);
 
-		for (; y > 0; --y) {
+		err = copy_plane_rows(src, fb->pitches[0], dst, dst_offset,
+				      byte_span,
+				      r->y2 - r->y1, full_width);
+		if (err)
+			return err;
+		if (format->num_planes < 2)
+			continue;
+
+		/* Chroma samples covering any pixel of the rect */
+		x1 = r->x1 / format->hsub;
+		x2 = DIV_ROUND_UP(r->x2, format->hsub);
+		y1 = r->y1 / format->vsub;
+		y2 = DIV_ROUND_UP(r->y2, format->vsub);
+		src = (char *)efb->obj->vmapping + fb->offsets[1] +
+		      fb->pitches[1] * y1 + x1 * format->cpp[1];
+		err = copy_plane_rows(src, fb->pitches[1], dst,
+				      (long)dst->stride * (max_y + y1) +
+				      x1 * format->cpp[1],
+				      (x2 - x1) * format->cpp[1],
+				      y2 - y1, full_width);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Copies the parts of an overlay within the dirty rects over the primary
+ * pixels, converting them to the format of the primary plane if needed.
+ */
+static int copy_overlay_pixels(struct evdi_framebuffer *efb,
+			       const struct evdi_overlay *overlay,
+			       const struct evdi_color *color,
+			       const struct evdi_pixel_dst *dst,
+			       int num_rects, struct drm_clip_rect *rects,
+			       int const max_x,
+			       int const max_y,
+			       uint32_t *row)
+{
+	struct drm_framebuffer *fb = &efb->base;
+	struct drm_framebuffer *ofb = &overlay->efb->base;
+	const bool convert = evdi_fb_is_bgr(ofb->format->format) !=
+			     evdi_fb_is_bgr(fb->format->format);
+	struct drm_clip_rect *r;
+
+	for (r = rects; r != rects + num_rects; ++r) {
+		const int x1 = max3(overlay->dst.x1, (int)r->x1, 0);
+		const int y1 = max3(overlay->dst.y1, (int)r->y1, 0);
+		const int x2 = min3(overlay->dst.x2, (int)r->x2, max_x);
+		const int y2 = min3(overlay->dst.y2, (int)r->y2, max_y);
+		const int byte_span = (x2 - x1) * 4;
+		const char *src;
+		long dst_offset;
+		int x, y;
+
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		src = (char *)overlay->efb->obj->vmapping + ofb->offsets[0] +
+		      ofb->pitches[0] * (overlay->src_y + y1 - overlay->dst.y1) +
+		      (overlay->src_x + x1 - overlay->dst.x1) * 4;
+		dst_offset = (long)dst->stride * y1 + x1 * 4;
+
+		for (y = y1; y < y2; ++y) {
 #if defined(CONFIG_X86)
 			drm_clflush_virt_range((void *)src, byte_span);
 #endif
-			if (copy_to_user(dst, src, byte_span))
+			if (convert) {
+				const uint32_t *pixels = (const uint32_t *)src;
+
+				for (x = 0; x < x2 - x1; ++x)
+					row[x] = evdi_fb_convert_pixel(pixels[x],
+								       ofb->format->format,
+								       fb->format->format);
+			} else if (color) {
+				memcpy(row, src, byte_span);
+			}
+			evdi_color_apply_row(color, fb->format->format, row,
+					     x2 - x1);
+			if (evdi_pixel_dst_write(dst, dst_offset,
+						 convert || color ? (void *)row : src,
+						 byte_span))
 				return -EFAULT;
 
-			src += fb->pitches[0];
-			dst += buf_byte_stride;
+			src += ofb->pitches[0];
+			dst_offset += dst->stride;
 		}
 	}
 
 	return 0;
 }
 
+/* Maps overlays for a grab, dropping those that cannot be read */
+static void evdi_painter_get_overlays(struct evdi_device *evdi,
+				      struct evdi_overlay *overlays,
+				      int num_overlays)
+{
+	struct dma_buf_attachment *import_attach;
+	int i;
+
+	for (i = 0; i < num_overlays; ++i) {
+		struct evdi_framebuffer *efb = overlays[i].efb;
+
+		if (evdi_vmap_cache_get(&evdi->vmap_cache, efb->obj)) {
+			EVDI_WARN("Failed to map overlay buffer\n");
+			goto err_fb;
+		}
+
+		import_attach = efb->obj->base.import_attach;
+		if (import_attach &&
+		    dma_buf_begin_cpu_access(import_attach->dmabuf,
+					     DMA_FROM_DEVICE)) {
+			evdi_vmap_cache_put(&evdi->vmap_cache, efb->obj);
+			goto err_fb;
+		}
+		continue;
+
+err_fb:
+		drm_framebuffer_put(&efb->base);
+		overlays[i].efb = NULL;
+	}
+}
+
+static void evdi_painter_put_overlays(struct evdi_device *evdi,
+				      struct evdi_overlay *overlays,
+				      int num_overlays)
+{
+	struct dma_buf_attachment *import_attach;
+	int i;
+
+	for (i = 0; i < num_overlays; ++i) {
+		struct evdi_framebuffer *efb = overlays[i].efb;
+
+		if (!efb)
+			continue;
+
+		import_attach = efb->obj->base.import_attach;
+		if (import_attach)
+			dma_buf_end_cpu_access(import_attach->dmabuf,
+					       DMA_FROM_DEVICE);
+		evdi_vmap_cache_put(&evdi->vmap_cache, efb->obj);
+		drm_framebuffer_put(&efb->base);
+	}
+}
+
 static void copy_cursor_pixels(struct evdi_framebuffer *efb,
-			       char __user *buffer,
-			       int buf_byte_stride,
+			       unsigned int rotation,
+			       const struct evdi_color *color,
+			       const struct evdi_overlay *overlays,
+			       int num_overlays,
+			       const struct evdi_pixel_dst *dst,
 			       struct evdi_cursor *cursor)
 {
 	evdi_cursor_lock(cursor);
 	if (evdi_cursor_compose_and_copy(cursor,
 					 efb,
-					 buffer,
-					 buf_byte_stride))
+					 rotation,
+					 color,
+					 overlays,
+					 num_overlays,
+					 dst))
 		EVDI_ERROR("Failed to blend cursor\n");
 
 	evdi_cursor_unlock(cursor);
@@ -291,24 +559,31 @@ bool evdi_painter_is_connected(struct evdi_painter *painter)
 	return painter ? painter->is_connected : false;
 }
 
-u8 *evdi_painter_get_edid_copy(struct evdi_device *evdi)
+bool evdi_painter_is_scanout(struct evdi_painter *painter,
+			     struct evdi_framebuffer *efb)
 {
+	return painter && READ_ONCE(painter->scanout_fb) == efb;
+}
+
+u8 *evdi_painter_get_edid_copy(struct evdi_head *head)
+{
+	struct evdi_painter *painter = head->painter;
 	u8 *block = NULL;
 
 	EVDI_CHECKPT();
 
-	painter_lock(evdi->painter);
-	if (evdi_painter_is_connected(evdi->painter) &&
-		evdi->painter->edid &&
-		evdi->painter->edid_length) {
-		block = kmalloc(evdi->painter->edid_length, GFP_KERNEL);
+	painter_lock(painter);
+	if (evdi_painter_is_connected(painter) &&
+		painter->edid &&
+		painter->edid_length) {
+		block = kmalloc(painter->edid_length, GFP_KERNEL);
 		if (block) {
 			memcpy(block,
-			       evdi->painter->edid,
-			       evdi->painter->edid_length);
+			       painter->edid,
+			       painter->edid_length);
 		}
 	}
-	painter_unlock(evdi->painter);
+	painter_unlock(painter);
 	return block;
 }
 
@@ -411,7 +686,38 @@ static void evdi_painter_send_event(struct evdi_painter *painter,
 	schedule_delayed_work(&painter->send_events_work, msecs_to_jiffies(5));
 }
 
-static struct drm_pending_event *create_update_ready_event(void)
+static bool evdi_painter_wants_event(struct evdi_painter *painter,
+				     uint32_t type)
+{
+	return READ_ONCE(painter->event_mask) & EVDI_EVENT_MASK_BIT(type);
+}
+
+/*
+ * Rects are merged the same way the grab will merge them, so the summary
+ * describes what the next grab copies.
+ */
+static void evdi_painter_damage_summary(
+	struct evdi_painter *painter,
+	struct drm_evdi_event_update_ready *summary)
+{
+	struct drm_clip_rect rects[MAX_DIRTS];
+	int i;
+
+	summary->num_rects = evdi_damage_peek(&painter->damage, rects,
+					      MAX_DIRTS);
+	summary->area = 0;
+	if (summary->num_rects == 0)
+		return;
+
+	summary->bounds = rects[0];
+	for (i = 0; i < summary->num_rects; ++i) {
+		evdi_damage_expand_rect(&summary->bounds, &rects[i]);
+		summary->area += evdi_damage_rect_area(&rects[i]);
+	}
+}
+
+static struct drm_pending_event *create_update_ready_event(
+	struct evdi_painter *painter)
 {
 	struct evdi_event_update_ready_pending *event;
 
@@ -423,14 +729,20 @@ static struct drm_pending_event *create_update_ready_event(void)
 
 	event->update_ready.base.type = DRM_EVDI_EVENT_UPDATE_READY;
 	event->update_ready.base.length = sizeof(event->update_ready);
+	event->update_ready.head = painter->head->index;
+	evdi_painter_damage_summary(painter, &event->update_ready);
 	event->base.event = &event->update_ready.base;
 	return &event->base;
 }
 
 static void evdi_painter_send_update_ready(struct evdi_painter *painter)
 {
-	struct drm_pending_event *event = create_update_ready_event();
+	struct drm_pending_event *event;
+
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_UPDATE_READY))
+		return;
 
+	event = create_update_ready_event(painter);
 	evdi_painter_send_event(painter, event);
 }
 
@@ -451,8 +763,11 @@ static uint32_t evdi_painter_get_gem_handle(struct evdi_painter *painter,
 			      &obj->base, &handle)) {
 		EVDI_ERROR("Failed to create gem handle for %p\n",
 			painter->drm_filp);
+		return 0;
 	}
 
+	evdi_gem_object_handle_cache(obj, painter->drm_filp, handle);
+
 	return handle;
 }
 
@@ -471,6 +786,7 @@ static struct drm_pending_event *create_cursor_set_event(
 
 	event->cursor_set.base.type = DRM_EVDI_EVENT_CURSOR_SET;
 	event->cursor_set.base.length = sizeof(event->cursor_set);
+	event->cursor_set.head = painter->head->index;
 
 	evdi_cursor_lock(cursor);
 	event->cursor_set.enabled = evdi_cursor_enabled(cursor);
@@ -499,13 +815,17 @@ static struct drm_pending_event *create_cursor_set_event(
 void evdi_painter_send_cursor_set(struct evdi_painter *painter,
 				  struct evdi_cursor *cursor)
 {
-	struct drm_pending_event *event =
-		create_cursor_set_event(painter, cursor);
+	struct drm_pending_event *event;
+
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_CURSOR_SET))
+		return;
 
+	event = create_cursor_set_event(painter, cursor);
 	evdi_painter_send_event(painter, event);
 }
 
 static struct drm_pending_event *create_cursor_move_event(
+		struct evdi_painter *painter,
 		struct evdi_cursor *cursor)
 {
 	struct evdi_event_cursor_move_pending *event;
@@ -518,6 +838,7 @@ static struct drm_pending_event *create_cursor_move_event(
 
 	event->cursor_move.base.type = DRM_EVDI_EVENT_CURSOR_MOVE;
 	event->cursor_move.base.length = sizeof(event->cursor_move);
+	event->cursor_move.head = painter->head->index;
 
 	evdi_cursor_lock(cursor);
 	evdi_cursor_position(
@@ -533,12 +854,18 @@ static struct drm_pending_event *create_cursor_move_event(
 void evdi_painter_send_cursor_move(struct evdi_painter *painter,
 				   struct evdi_cursor *cursor)
 {
-	struct drm_pending_event *event = create_cursor_move_event(cursor);
+	struct drm_pending_event *event;
+
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_CURSOR_MOVE))
+		return;
 
+	event = create_cursor_move_event(painter, cursor);
 	evdi_painter_send_event(painter, event);
 }
 
-static struct drm_pending_event *create_dpms_event(int mode)
+static struct drm_pending_event *create_dpms_event(
+	struct evdi_painter *painter,
+	int mode)
 {
 	struct evdi_event_dpms_pending *event;
 
@@ -551,19 +878,25 @@ static struct drm_pending_event *create_dpms_event(int mode)
 	event->dpms.base.type = DRM_EVDI_EVENT_DPMS;
 	event->dpms.base.length = sizeof(event->dpms);
 	event->dpms.mode = mode;
+	event->dpms.head = painter->head->index;
 	event->base.event = &event->dpms.base;
 	return &event->base;
 }
 
 static void evdi_painter_send_dpms(struct evdi_painter *painter, int mode)
 {
-	struct drm_pending_event *event = create_dpms_event(mode);
+	struct drm_pending_event *event;
 
 	EVDI_TEST_HOOK(evdi_testhook_painter_send_dpms(mode));
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_DPMS))
+		return;
+
+	event = create_dpms_event(painter, mode);
 	evdi_painter_send_event(painter, event);
 }
 
 static struct drm_pending_event *create_mode_changed_event(
+	struct evdi_painter *painter,
 	struct drm_display_mode *current_mode,
 	int32_t bits_per_pixel,
 	uint32_t pixel_format)
@@ -584,6 +917,7 @@ static struct drm_pending_event *create_mode_changed_event(
 	event->mode_changed.vrefresh = drm_mode_vrefresh(current_mode);
 	event->mode_changed.bits_per_pixel = bits_per_pixel;
 	event->mode_changed.pixel_format = pixel_format;
+	event->mode_changed.head = painter->head->index;
 
 	event->base.event = &event->mode_changed.base;
 	return &event->base;
@@ -595,96 +929,287 @@ static void evdi_painter_send_mode_changed(
 	int32_t bits_per_pixel,
 	uint32_t pixel_format)
 {
-	struct drm_pending_event *event = create_mode_changed_event(
-		current_mode, bits_per_pixel, pixel_format);
+	struct drm_pending_event *event;
+
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_MODE_CHANGED))
+		return;
 
+	event = create_mode_changed_event(painter, current_mode,
+					  bits_per_pixel, pixel_format);
 	evdi_painter_send_event(painter, event);
 }
 
 int evdi_painter_get_num_dirts(struct evdi_painter *painter)
 {
-	int num_dirts;
-
 	if (painter == NULL) {
 		EVDI_WARN("Painter is not connected!\n");
 		return 0;
 	}
 
-	painter_lock(painter);
-
-	num_dirts = painter->num_dirts;
-
-	painter_unlock(painter);
-
-	return num_dirts;
+	return evdi_damage_pending(&painter->damage) +
+	       atomic_read(&painter->fences_pending);
 }
 
 struct drm_clip_rect evdi_painter_framebuffer_size(
 	struct evdi_painter *painter)
 {
 	struct drm_clip_rect rect = {0, 0, 0, 0};
-	struct evdi_framebuffer *efb = NULL;
 
 	if (painter == NULL) {
 		EVDI_WARN("Painter is not connected!\n");
 		return rect;
 	}
 
-	painter_lock(painter);
-	efb = painter->scanout_fb;
-	if (!efb) {
-		if (painter->is_connected)
-			EVDI_WARN("Scanout buffer not set.\n");
-		goto unlock;
-	}
-	rect.x1 = 0;
-	rect.y1 = 0;
-	rect.x2 = efb->base.width;
-	rect.y2 = efb->base.height;
-unlock:
-	painter_unlock(painter);
+	rect = evdi_damage_size(&painter->damage);
+	if (!rect.x2 && READ_ONCE(painter->is_connected))
+		EVDI_WARN("Scanout buffer not set.\n");
+
 	return rect;
 }
 
-void evdi_painter_mark_dirty(struct evdi_device *evdi,
+/*
+ * Called several times per commit, so it must not take the painter lock
+ * which the grab may be holding.
+ */
+void evdi_painter_mark_dirty(struct evdi_head *head,
 			     const struct drm_clip_rect *dirty_rect)
 {
-	struct drm_clip_rect rect;
-	struct evdi_framebuffer *efb = NULL;
-	struct evdi_painter *painter = evdi->painter;
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
 
 	if (painter == NULL) {
 		EVDI_WARN("Painter is not connected!\n");
 		return;
 	}
 
-	painter_lock(painter);
-	efb = painter->scanout_fb;
-	if (!efb) {
-		if (painter->is_connected)
-			EVDI_WARN("(card%d) Skip clip rect. Scanout buffer not set.\n",
-			   evdi->dev_index);
-		goto unlock;
+	EVDI_VERBOSE("(card%d) %d,%d-%d,%d\n", evdi->dev_index, dirty_rect->x1,
+		     dirty_rect->y1, dirty_rect->x2, dirty_rect->y2);
+
+	if (!evdi_damage_add(&painter->damage, dirty_rect) &&
+	    READ_ONCE(painter->is_connected))
+		EVDI_WARN("(card%d) Skip clip rect. Scanout buffer not set.\n",
+			  evdi->dev_index);
+}
+
+/* Moves damage of the scanout buffer to where the rotation shows it */
+static void evdi_painter_mark_fb_rect_dirty(struct evdi_head *head,
+					    const struct drm_clip_rect *rect)
+{
+	struct evdi_painter *painter = head->painter;
+	const unsigned int rotation = READ_ONCE(painter->rotation);
+	const struct drm_clip_rect size = evdi_damage_size(&painter->damage);
+	struct drm_rect r = { rect->x1, rect->y1, rect->x2, rect->y2 };
+	struct drm_clip_rect rotated;
+	int width = size.x2;
+	int height = size.y2;
+
+	if (rotation == DRM_MODE_ROTATE_0) {
+		evdi_painter_mark_dirty(head, rect);
+		return;
 	}
 
-	rect = evdi_framebuffer_sanitize_rect(efb, dirty_rect);
+	if (drm_rotation_90_or_270(rotation))
+		swap(width, height);
+	drm_rect_rotate(&r, width, height, rotation);
 
-	EVDI_VERBOSE("(card%d) %d,%d-%d,%d\n", evdi->dev_index, rect.x1,
-		     rect.y1, rect.x2, rect.y2);
+	rotated.x1 = max(r.x1, 0);
+	rotated.y1 = max(r.y1, 0);
+	rotated.x2 = max(r.x2, 0);
+	rotated.y2 = max(r.y2, 0);
+	evdi_painter_mark_dirty(head, &rotated);
+}
 
-	if (painter->num_dirts == MAX_DIRTS)
-		merge_dirty_rects(&painter->dirty_rects[0],
-				  &painter->num_dirts);
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+struct evdi_painter_fence_waiter {
+	struct dma_fence_cb cb;
+	struct work_struct work;
+	struct list_head node;
+	struct dma_fence *fence;
+	struct evdi_head *head;
+	int num_rects;
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+};
 
-	if (painter->num_dirts == MAX_DIRTS)
-		collapse_dirty_rects(&painter->dirty_rects[0],
-				     &painter->num_dirts);
+static void evdi_painter_fence_work(struct work_struct *work)
+{
+	struct evdi_painter_fence_waiter *waiter =
+		container_of(work, struct evdi_painter_fence_waiter, work);
+	struct evdi_painter *painter = waiter->head->painter;
+	unsigned long flags;
+	int i;
 
-	memcpy(&painter->dirty_rects[painter->num_dirts], &rect, sizeof(rect));
-	painter->num_dirts++;
+	spin_lock_irqsave(&painter->fence_lock, flags);
+	list_del(&waiter->node);
+	spin_unlock_irqrestore(&painter->fence_lock, flags);
 
-unlock:
-	painter_unlock(painter);
+	for (i = 0; i < waiter->num_rects; ++i)
+		evdi_painter_mark_fb_rect_dirty(waiter->head, &waiter->rects[i]);
+
+	evdi_painter_send_update_ready_if_needed(painter);
+	dma_fence_put(waiter->fence);
+
+	/* Painter may be freed as soon as the last fence is done */
+	if (atomic_dec_and_test(&painter->fences_pending))
+		wake_up_var(&painter->fences_pending);
+	kfree(waiter);
+}
+
+static void evdi_painter_fence_signaled(__always_unused struct dma_fence *fence,
+					struct dma_fence_cb *cb)
+{
+	struct evdi_painter_fence_waiter *waiter =
+		container_of(cb, struct evdi_painter_fence_waiter, cb);
+
+	queue_work(system_highpri_wq, &waiter->work);
+}
+
+static struct dma_fence *evdi_painter_render_fence(struct evdi_framebuffer *efb)
+{
+	struct dma_buf_attachment *import_attach = efb->obj->base.import_attach;
+	struct dma_fence *fence = NULL;
+
+	if (!import_attach)
+		return NULL;
+
+	if (dma_resv_get_singleton(import_attach->dmabuf->resv,
+				   DMA_RESV_USAGE_WRITE, &fence))
+		return NULL;
+
+	if (fence && dma_fence_is_signaled(fence)) {
+		dma_fence_put(fence);
+		return NULL;
+	}
+
+	return fence;
+}
+
+static bool evdi_painter_mark_dirty_after_fence(struct evdi_head *head,
+						struct evdi_framebuffer *efb,
+						const struct drm_clip_rect *rects,
+						int num_rects)
+{
+	struct evdi_painter *painter = head->painter;
+	struct evdi_painter_fence_waiter *waiter;
+	struct dma_fence *fence;
+	int i;
+
+	fence = evdi_painter_render_fence(efb);
+	if (!fence)
+		return false;
+
+	waiter = kzalloc(sizeof(*waiter), GFP_KERNEL);
+	if (!waiter) {
+		dma_fence_put(fence);
+		return false;
+	}
+
+	INIT_WORK(&waiter->work, evdi_painter_fence_work);
+	INIT_LIST_HEAD(&waiter->node);
+	waiter->fence = fence;
+	waiter->head = head;
+	for (i = 0; i < num_rects; ++i) {
+		if (waiter->num_rects < EVDI_DAMAGE_MAX_RECTS)
+			waiter->rects[waiter->num_rects++] = rects[i];
+		else
+			evdi_damage_expand_rect(&waiter->rects[EVDI_DAMAGE_MAX_RECTS - 1],
+						&rects[i]);
+	}
+
+	atomic_inc(&painter->fences_pending);
+	spin_lock_irq(&painter->fence_lock);
+	list_add_tail(&waiter->node, &painter->fence_waiters);
+	spin_unlock_irq(&painter->fence_lock);
+	if (dma_fence_add_callback(fence, &waiter->cb,
+				   evdi_painter_fence_signaled))
+		evdi_painter_fence_work(&waiter->work);
+
+	return true;
+}
+
+/*
+ * Drops the waiters whose fence has not signalled, so removal does not
+ * depend on the exporter. Their damage is lost with the painter anyway.
+ */
+static void evdi_painter_cancel_fence_waiters(struct evdi_painter *painter)
+{
+	struct evdi_painter_fence_waiter *waiter, *tmp;
+	LIST_HEAD(cancelled);
+
+	spin_lock_irq(&painter->fence_lock);
+	list_for_each_entry_safe(waiter, tmp, &painter->fence_waiters, node)
+		if (dma_fence_remove_callback(waiter->fence, &waiter->cb))
+			list_move(&waiter->node, &cancelled);
+	spin_unlock_irq(&painter->fence_lock);
+
+	list_for_each_entry_safe(waiter, tmp, &cancelled, node) {
+		dma_fence_put(waiter->fence);
+		atomic_dec(&painter->fences_pending);
+		kfree(waiter);
+	}
+}
+
+/*
+ * Waits a bounded time for rendering to an imported buffer to complete,
+ * as damage of the previous buffer may be grabbed from a new one whose
+ * fence is still outstanding.
+ */
+static int evdi_painter_wait_for_render(struct evdi_framebuffer *efb)
+{
+	struct dma_fence *fence = evdi_painter_render_fence(efb);
+	long ret;
+
+	if (!fence)
+		return 0;
+
+	ret = dma_fence_wait_timeout(fence, true,
+				     msecs_to_jiffies(RENDER_FENCE_TIMEOUT_MS));
+	dma_fence_put(fence);
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -EAGAIN;
+}
+#else
+static bool evdi_painter_mark_dirty_after_fence(
+		__always_unused struct evdi_head *head,
+		__always_unused struct evdi_framebuffer *efb,
+		__always_unused const struct drm_clip_rect *rects,
+		__always_unused int num_rects)
+{
+	return false;
+}
+
+static void evdi_painter_cancel_fence_waiters(
+		__always_unused struct evdi_painter *painter)
+{
+}
+
+static int evdi_painter_wait_for_render(
+		__always_unused struct evdi_framebuffer *efb)
+{
+	return 0;
+}
+#endif
+
+/*
+ * For imported buffers the damage is only made visible, and update ready
+ * sent, once the rendering which produced it has completed, so a grab
+ * never waits for the GPU or copies a frame still being rendered.
+ */
+void evdi_painter_mark_fb_dirty(struct evdi_head *head,
+				struct evdi_framebuffer *efb,
+				const struct drm_clip_rect *rects,
+				int num_rects)
+{
+	int i;
+
+	if (!head->painter || num_rects <= 0)
+		return;
+
+	if (evdi_painter_mark_dirty_after_fence(head, efb, rects, num_rects))
+		return;
+
+	for (i = 0; i < num_rects; ++i)
+		evdi_painter_mark_fb_rect_dirty(head, &rects[i]);
 }
 
 static void evdi_send_vblank(struct drm_crtc *crtc,
@@ -699,59 +1224,174 @@ static void evdi_send_vblank(struct drm_crtc *crtc,
 	}
 }
 
-static void evdi_painter_send_vblank(struct evdi_painter *painter)
+/* Sends the event on the next emulated vblank if the timer is running */
+static void evdi_arm_vblank(struct drm_crtc *crtc,
+			    struct drm_pending_vblank_event *vblank)
+{
+	if (crtc && vblank) {
+		unsigned long flags = 0;
+
+		spin_lock_irqsave(&crtc->dev->event_lock, flags);
+		if (drm_crtc_vblank_get(crtc) == 0)
+			drm_crtc_arm_vblank_event(crtc, vblank);
+		else
+			drm_crtc_send_vblank_event(crtc, vblank);
+		spin_unlock_irqrestore(&crtc->dev->event_lock, flags);
+	}
+}
+
+/* Takes the held vblank out of the painter, called with vblank_lock held */
+static struct drm_pending_vblank_event *
+evdi_painter_take_vblank(struct evdi_painter *painter, struct drm_crtc **crtc)
+{
+	struct drm_pending_vblank_event *vblank = painter->vblank;
+
+	if (vblank) {
+		const u64 held_ns = ktime_to_ns(ktime_sub(ktime_get(),
+						painter->vblank_held_since));
+
+		painter->vblank_held_ns_total += held_ns;
+		painter->vblank_held_ns_max =
+			max(painter->vblank_held_ns_max, held_ns);
+	}
+
+	*crtc = painter->crtc;
+	painter->crtc = NULL;
+	painter->vblank = NULL;
+
+	return vblank;
+}
+
+static void evdi_painter_send_vblank(struct evdi_painter *painter)
+{
+	struct drm_crtc *crtc;
+	struct drm_pending_vblank_event *vblank;
+
+	EVDI_CHECKPT();
+
+	spin_lock(&painter->vblank_lock);
+	vblank = evdi_painter_take_vblank(painter, &crtc);
+	spin_unlock(&painter->vblank_lock);
+
+	evdi_send_vblank(crtc, vblank);
+}
+
+static void evdi_painter_vblank_timeout_work(struct work_struct *work)
 {
-	EVDI_CHECKPT();
+	struct evdi_painter *painter = container_of(work, struct evdi_painter,
+						    vblank_timeout_work.work);
+	struct drm_crtc *crtc;
+	struct drm_pending_vblank_event *vblank;
 
-	evdi_send_vblank(painter->crtc, painter->vblank);
+	spin_lock(&painter->vblank_lock);
+	vblank = evdi_painter_take_vblank(painter, &crtc);
+	if (vblank)
+		painter->vblanks_timed_out++;
+	spin_unlock(&painter->vblank_lock);
 
-	painter->crtc = NULL;
-	painter->vblank = NULL;
+	if (vblank)
+		EVDI_VERBOSE("Flip timed out waiting for a grab\n");
+	evdi_send_vblank(crtc, vblank);
 }
 
 void evdi_painter_set_vblank(
 	struct evdi_painter *painter,
 	struct drm_crtc *crtc,
-	struct drm_pending_vblank_event *vblank)
+	struct drm_pending_vblank_event *vblank,
+	bool async)
 {
+	struct evdi_device *evdi = crtc ? crtc->dev->dev_private : NULL;
+	enum evdi_flip_policy policy = EVDI_FLIP_BLOCK;
+	struct drm_crtc *old_crtc;
+	struct drm_pending_vblank_event *old_vblank;
+	bool hold;
+
 	EVDI_CHECKPT();
 
-	if (painter) {
-		painter_lock(painter);
+	if (!painter) {
+		evdi_arm_vblank(crtc, vblank);
+		return;
+	}
 
-		evdi_painter_send_vblank(painter);
+	if (evdi)
+		policy = READ_ONCE(evdi->flip_policy);
+
+	/*
+	 * Checking for damage and holding the vblank must not interleave with
+	 * a grab taking the damage, or the vblank would be held with nothing
+	 * left to grab.
+	 */
+	spin_lock(&painter->vblank_lock);
+	old_vblank = evdi_painter_take_vblank(painter, &old_crtc);
+
+	hold = vblank && !async && policy != EVDI_FLIP_IMMEDIATE &&
+	       (evdi_damage_pending(&painter->damage) ||
+		atomic_read(&painter->fences_pending)) &&
+	       READ_ONCE(painter->is_connected);
+	if (hold) {
+		painter->crtc = crtc;
+		painter->vblank = vblank;
+		painter->vblank_held_since = ktime_get();
+		painter->vblanks_held++;
+		crtc = NULL;
+		vblank = NULL;
+	}
+	spin_unlock(&painter->vblank_lock);
 
-		if (painter->num_dirts > 0 && painter->is_connected) {
-			painter->crtc = crtc;
-			painter->vblank = vblank;
-		} else {
-			evdi_send_vblank(crtc, vblank);
-		}
+	if (hold && policy == EVDI_FLIP_TIMEOUT)
+		mod_delayed_work(system_wq, &painter->vblank_timeout_work,
+				 msecs_to_jiffies(READ_ONCE(evdi->flip_timeout_ms)));
 
-		painter_unlock(painter);
-	} else {
+	evdi_send_vblank(old_crtc, old_vblank);
+	if (async)
 		evdi_send_vblank(crtc, vblank);
-	}
+	else
+		evdi_arm_vblank(crtc, vblank);
 }
 
 void evdi_painter_send_update_ready_if_needed(struct evdi_painter *painter)
 {
+	bool has_damage;
+
 	EVDI_CHECKPT();
-	if (painter) {
-		painter_lock(painter);
+	if (!painter) {
+		EVDI_WARN("Painter does not exist!\n");
+		return;
+	}
+
+	/* Pairs with the barrier in evdi_painter_request_update_ioctl */
+	smp_mb();
+	has_damage = evdi_damage_pending(&painter->damage);
+
 #if KERNEL_VERSION(5, 10, 0) <= LINUX_VERSION_CODE || defined(EL8)
-		if (painter->was_update_requested && painter->num_dirts) {
+	if (has_damage && atomic_xchg(&painter->was_update_requested, 0))
 #else
-		if (painter->was_update_requested) {
+	if (atomic_xchg(&painter->was_update_requested, 0))
 #endif
-			evdi_painter_send_update_ready(painter);
-			painter->was_update_requested = false;
-		}
+		evdi_painter_send_update_ready(painter);
 
-		painter_unlock(painter);
-	} else {
-		EVDI_WARN("Painter does not exist!\n");
-	}
+	if (has_damage)
+		wake_up_interruptible(&painter->damage_wait);
+}
+
+static void evdi_painter_release_work(struct work_struct *work)
+{
+	struct evdi_painter *painter =
+		container_of(work, struct evdi_painter, release_work.work);
+	struct evdi_device *evdi = painter->drm_device->dev_private;
+
+	EVDI_DEBUG("(card%d) Display idle, releasing buffer mappings\n",
+		   evdi->dev_index);
+	evdi_vmap_cache_trim(&evdi->vmap_cache);
+}
+
+static void evdi_painter_set_idle(struct evdi_painter *painter, bool idle)
+{
+	if (idle && evdi_idle_release_ms)
+		mod_delayed_work(system_wq, &painter->release_work,
+				 msecs_to_jiffies(evdi_idle_release_ms));
+	else
+		cancel_delayed_work(&painter->release_work);
 }
 
 static const char * const dpms_str[] = { "on", "standby", "suspend", "off" };
@@ -786,6 +1426,7 @@ void evdi_painter_dpms_notify(struct evdi_painter *painter, int mode)
 	EVDI_INFO("(card%d) Notifying display power state: %s\n",
 		   painter->drm_device->primary->index, mode_str);
 	evdi_painter_send_dpms(painter, mode);
+	evdi_painter_set_idle(painter, mode != DRM_MODE_DPMS_ON);
 }
 
 static void evdi_log_pixel_format(uint32_t pixel_format,
@@ -801,10 +1442,11 @@ static void evdi_log_pixel_format(uint32_t pixel_format,
 #endif
 }
 
-void evdi_painter_mode_changed_notify(struct evdi_device *evdi,
+void evdi_painter_mode_changed_notify(struct evdi_head *head,
 				      struct drm_display_mode *new_mode)
 {
-	struct evdi_painter *painter = evdi->painter;
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
 	struct drm_framebuffer *fb;
 	int bits_per_pixel;
 	uint32_t pixel_format;
@@ -820,13 +1462,14 @@ void evdi_painter_mode_changed_notify(struct evdi_device *evdi,
 		return;
 	}
 
-	bits_per_pixel = fb->format->cpp[0] * 8;
+	bits_per_pixel = evdi_fb_get_bpp(fb->format->format);
 	pixel_format = fb->format->format;
 	painter_unlock(painter);
 
 	evdi_log_pixel_format(pixel_format, buf, sizeof(buf));
-	EVDI_INFO("(card%d) Notifying mode changed: %dx%d@%d; bpp %d; %s\n",
-		   evdi->dev_index, new_mode->hdisplay, new_mode->vdisplay,
+	EVDI_INFO("(card%d) Notifying mode changed on head %u: %dx%d@%d; bpp %d; %s\n",
+		   evdi->dev_index, head->index,
+		   new_mode->hdisplay, new_mode->vdisplay,
 		   drm_mode_vrefresh(new_mode), bits_per_pixel, buf);
 
 	evdi_painter_send_mode_changed(painter,
@@ -851,35 +1494,36 @@ static void evdi_painter_events_cleanup(struct evdi_painter *painter)
 	cancel_delayed_work_sync(&painter->send_events_work);
 }
 
-static void evdi_add_i2c_adapter(struct evdi_device *evdi)
+static void evdi_add_i2c_adapter(struct evdi_head *head)
 {
+	struct evdi_device *evdi = head->evdi;
 	struct drm_device *ddev = evdi->ddev;
 	struct platform_device *platdev = to_platform_device(ddev->dev);
 	int result = 0;
 
-	evdi->i2c_adapter = kzalloc(sizeof(*evdi->i2c_adapter), GFP_KERNEL);
+	head->i2c_adapter = kzalloc(sizeof(*head->i2c_adapter), GFP_KERNEL);
 
-	if (!evdi->i2c_adapter) {
+	if (!head->i2c_adapter) {
 		EVDI_ERROR("(card%d) Failed to allocate for i2c adapter\n",
 			evdi->dev_index);
 		return;
 	}
 
-	result = evdi_i2c_add(evdi->i2c_adapter, &platdev->dev, ddev->dev_private);
+	result = evdi_i2c_add(head->i2c_adapter, &platdev->dev, head);
 
 	if (result) {
-		kfree(evdi->i2c_adapter);
-		evdi->i2c_adapter = NULL;
+		kfree(head->i2c_adapter);
+		head->i2c_adapter = NULL;
 		EVDI_ERROR("(card%d) Failed to add i2c adapter, error %d\n",
 			evdi->dev_index, result);
 		return;
 	}
 
-	EVDI_INFO("(card%d) Added i2c adapter bus number %d\n",
-		evdi->dev_index, evdi->i2c_adapter->nr);
+	EVDI_INFO("(card%d) Added i2c adapter bus number %d for head %u\n",
+		evdi->dev_index, head->i2c_adapter->nr, head->index);
 
-	result = sysfs_create_link(&evdi->conn->kdev->kobj,
-			&evdi->i2c_adapter->dev.kobj, "ddc");
+	result = sysfs_create_link(&head->conn->kdev->kobj,
+			&head->i2c_adapter->dev.kobj, "ddc");
 
 	if (result) {
 		EVDI_ERROR("(card%d) Failed to create sysfs link, error %d\n",
@@ -888,29 +1532,30 @@ static void evdi_add_i2c_adapter(struct evdi_device *evdi)
 	}
 }
 
-static void evdi_remove_i2c_adapter(struct evdi_device *evdi)
+static void evdi_remove_i2c_adapter(struct evdi_head *head)
 {
-	if (evdi->i2c_adapter) {
+	if (head->i2c_adapter) {
 		EVDI_INFO("(card%d) Removing i2c adapter bus number %d\n",
-			evdi->dev_index, evdi->i2c_adapter->nr);
+			head->evdi->dev_index, head->i2c_adapter->nr);
 
-		sysfs_remove_link(&evdi->conn->kdev->kobj, "ddc");
+		sysfs_remove_link(&head->conn->kdev->kobj, "ddc");
 
-		evdi_i2c_remove(evdi->i2c_adapter);
+		evdi_i2c_remove(head->i2c_adapter);
 
-		kfree(evdi->i2c_adapter);
-		evdi->i2c_adapter = NULL;
+		kfree(head->i2c_adapter);
+		head->i2c_adapter = NULL;
 	}
 }
 
 static int
-evdi_painter_connect(struct evdi_device *evdi,
+evdi_painter_connect(struct evdi_head *head,
 		     void const __user *edid_data, unsigned int edid_length,
 		     uint32_t pixel_area_limit,
 		     uint32_t pixel_per_second_limit,
 		     struct drm_file *file, __always_unused int dev_index)
 {
-	struct evdi_painter *painter = evdi->painter;
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
 	struct edid *new_edid = NULL;
 	char buf[100];
 
@@ -942,31 +1587,48 @@ evdi_painter_connect(struct evdi_device *evdi,
 
 	painter_lock(painter);
 
-	evdi->pixel_area_limit = pixel_area_limit;
-	evdi->pixel_per_second_limit = pixel_per_second_limit;
+	head->pixel_area_limit = pixel_area_limit;
+	head->pixel_per_second_limit = pixel_per_second_limit;
 	painter->drm_filp = file;
+	/* A mask set by an earlier or unconnected client does not carry over */
+	WRITE_ONCE(painter->event_mask, EVDI_EVENT_MASK_ALL);
 	kfree(painter->edid);
 	painter->edid_length = edid_length;
 	painter->edid = new_edid;
 	painter->is_connected = true;
 	painter->needs_full_modeset = true;
+	evdi_painter_set_idle(painter, false);
 
-	if (!evdi->i2c_adapter)
-		evdi_add_i2c_adapter(evdi);
+	if (!head->i2c_adapter)
+		evdi_add_i2c_adapter(head);
 
 	painter_unlock(painter);
 
-	EVDI_INFO("(card%d) Connected with %s\n", evdi->dev_index, buf);
+	EVDI_INFO("(card%d) Head %u connected with %s\n", evdi->dev_index,
+		  head->index, buf);
 
 	drm_helper_hpd_irq_event(evdi->ddev);
 
 	return 0;
 }
 
-static int evdi_painter_disconnect(struct evdi_device *evdi,
+/* Called with the painter lock held */
+static void evdi_painter_clear_overlays(struct evdi_painter *painter)
+{
+	unsigned int i;
+
+	for (i = 0; i < EVDI_MAX_OVERLAYS; ++i) {
+		if (painter->overlays[i].efb)
+			drm_framebuffer_put(&painter->overlays[i].efb->base);
+		painter->overlays[i].efb = NULL;
+	}
+}
+
+static int evdi_painter_disconnect(struct evdi_head *head,
 	struct drm_file *file)
 {
-	struct evdi_painter *painter = evdi->painter;
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
 	char buf[100];
 
 	EVDI_CHECKPT();
@@ -982,32 +1644,38 @@ static int evdi_painter_disconnect(struct evdi_device *evdi,
 		drm_framebuffer_put(&painter->scanout_fb->base);
 		painter->scanout_fb = NULL;
 	}
+	evdi_painter_clear_overlays(painter);
+	evdi_damage_set_size(&painter->damage, 0, 0);
 
 	painter->is_connected = false;
+	evdi_painter_set_idle(painter, true);
 
 	evdi_log_process(buf, sizeof(buf));
-	EVDI_INFO("(card%d) Disconnected from %s\n", evdi->dev_index, buf);
+	EVDI_INFO("(card%d) Head %u disconnected from %s\n", evdi->dev_index,
+		  head->index, buf);
 	evdi_painter_events_cleanup(painter);
 
 	evdi_painter_send_vblank(painter);
 
-	evdi_cursor_enable(evdi->cursor, false);
+	evdi_cursor_enable(head->cursor, false);
 
 	kfree(painter->ddcci_buffer);
 	painter->ddcci_buffer = NULL;
 	painter->ddcci_buffer_length = 0;
 
-	evdi_remove_i2c_adapter(evdi);
+	evdi_remove_i2c_adapter(head);
 
 	painter->drm_filp = NULL;
 
-	painter->was_update_requested = false;
-	evdi->cursor_events_enabled = false;
+	atomic_set(&painter->was_update_requested, 0);
+	painter->event_mask = EVDI_EVENT_MASK_ALL;
+	head->cursor_events_enabled = false;
 
 	painter_unlock(painter);
 
 	// Signal anything waiting for ddc/ci response with NULL buffer
 	complete(&painter->ddcci_response_received);
+	wake_up_interruptible(&painter->damage_wait);
 
 	drm_helper_hpd_irq_event(evdi->ddev);
 	return 0;
@@ -1015,24 +1683,33 @@ static int evdi_painter_disconnect(struct evdi_device *evdi,
 
 void evdi_painter_close(struct evdi_device *evdi, struct drm_file *file)
 {
+	unsigned int i;
+
 	EVDI_CHECKPT();
 
-	if (evdi->painter && file == evdi->painter->drm_filp)
-		evdi_painter_disconnect(evdi, file);
+	for (i = 0; i < evdi->num_heads; ++i) {
+		struct evdi_head *head = &evdi->heads[i];
+
+		if (head->painter && file == head->painter->drm_filp)
+			evdi_painter_disconnect(head, file);
+	}
 }
 
 int evdi_painter_connect_ioctl(struct drm_device *drm_dev, void *data,
 			       struct drm_file *file)
 {
 	struct evdi_device *evdi = drm_dev->dev_private;
-	struct evdi_painter *painter = evdi->painter;
 	struct drm_evdi_connect *cmd = data;
+	struct evdi_head *head = evdi_head_get(evdi, cmd->head);
 	int ret;
 
 	EVDI_CHECKPT();
-	if (painter) {
+	if (!head)
+		return -EINVAL;
+
+	if (head->painter) {
 		if (cmd->connected)
-			ret = evdi_painter_connect(evdi,
+			ret = evdi_painter_connect(head,
 					     cmd->edid,
 					     cmd->edid_length,
 					     cmd->pixel_area_limit,
@@ -1040,7 +1717,7 @@ int evdi_painter_connect_ioctl(struct drm_device *drm_dev, void *data,
 					     file,
 					     cmd->dev_index);
 		else
-			ret = evdi_painter_disconnect(evdi, file);
+			ret = evdi_painter_disconnect(head, file);
 
 		if (ret) {
 			EVDI_WARN("(card%d)(pid=%d) disconnect failed\n",
@@ -1052,14 +1729,108 @@ int evdi_painter_connect_ioctl(struct drm_device *drm_dev, void *data,
 	return -ENODEV;
 }
 
-int evdi_painter_grabpix_ioctl(struct drm_device *drm_dev, void *data,
-			       __always_unused struct drm_file *file)
+/*
+ * Takes references to the scanout buffer, color management and overlays of
+ * the head, so they can be composed once the painter lock is dropped.
+ * Called with the lock held, returns NULL when no buffer is scanned out.
+ */
+static struct evdi_framebuffer *evdi_painter_get_frame(struct evdi_head *head,
+						       unsigned int *rotation,
+						       struct evdi_color **color,
+						       struct evdi_overlay *overlays,
+						       int *num_overlays)
 {
-	struct evdi_device *evdi = drm_dev->dev_private;
-	struct evdi_painter *painter = evdi->painter;
-	struct drm_evdi_grabpix *cmd = data;
+	struct evdi_painter *painter = head->painter;
+	struct evdi_framebuffer *efb = painter->scanout_fb;
+	unsigned int i;
+
+	*num_overlays = 0;
+	if (!efb)
+		return NULL;
+
+	drm_framebuffer_get(&efb->base);
+	*rotation = painter->rotation;
+	*color = evdi_color_get(painter->color);
+
+	/* Overlays are only composed over 8 bits per component RGB */
+	for (i = 0; i < head->num_overlays &&
+		    evdi_fb_is_rgb8888(efb->base.format->format); ++i) {
+		if (!painter->overlays[i].efb)
+			continue;
+		overlays[*num_overlays] = painter->overlays[i];
+		drm_framebuffer_get(&overlays[(*num_overlays)++].efb->base);
+	}
+
+	return efb;
+}
+
+/* Copies the rects of the frame as shown on the CRTC to the destination */
+static int evdi_painter_compose(struct evdi_head *head,
+				struct evdi_framebuffer *efb,
+				unsigned int rotation,
+				const struct evdi_color *color,
+				const struct evdi_overlay *overlays,
+				int num_overlays,
+				const struct evdi_pixel_dst *dst,
+				int num_rects, struct drm_clip_rect *rects,
+				bool with_cursor)
+{
+	uint32_t *row = NULL;
+	int width, height;
+	int i;
+	int err;
+
+	evdi_fb_rotated_size(&efb->base, rotation, &width, &height);
+	err = copy_primary_pixels(efb,
+				  rotation,
+				  color,
+				  dst,
+				  num_rects,
+				  rects,
+				  width,
+				  height);
+	if (err == 0 && num_overlays) {
+		row = kmalloc_array(width, sizeof(*row), GFP_KERNEL);
+		if (!row)
+			err = -ENOMEM;
+	}
+	for (i = 0; err == 0 && i < num_overlays; ++i) {
+		if (overlays[i].efb)
+			err = copy_overlay_pixels(efb, &overlays[i], color,
+						  dst,
+						  num_rects,
+						  rects,
+						  width, height, row);
+	}
+	kfree(row);
+	if (err == 0 && with_cursor)
+		copy_cursor_pixels(efb,
+				   rotation,
+				   color,
+				   overlays,
+				   num_overlays,
+				   dst,
+				   head->cursor);
+
+	return err;
+}
+
+static int evdi_painter_grab(struct evdi_head *head,
+			     struct drm_evdi_grabpix *cmd)
+{
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
 	struct evdi_framebuffer *efb = NULL;
 	struct drm_clip_rect dirty_rects[MAX_DIRTS];
+	struct evdi_overlay overlays[EVDI_MAX_OVERLAYS];
+	int num_overlays = 0;
+	const struct evdi_pixel_dst dst = {
+		.user = cmd->buffer,
+		.stride = cmd->buf_byte_stride,
+	};
+	unsigned int rotation;
+	struct evdi_color *color;
+	int width, height, buf_height;
 	struct drm_crtc *crtc = NULL;
 	struct drm_pending_vblank_event *vblank = NULL;
 	int err;
@@ -1081,74 +1852,68 @@ int evdi_painter_grabpix_ioctl(struct drm_device *drm_dev, void *data,
 	if (!painter)
 		return -ENODEV;
 
-	painter_lock(painter);
-
-	if (painter->was_update_requested) {
+	if (atomic_read(&painter->was_update_requested)) {
 		EVDI_WARN("(card%d) Update ready not sent,",
 			  evdi->dev_index);
 		EVDI_WARN(" but pixels are grabbed.\n");
 	}
 
-	if (painter->num_dirts < 0) {
-		err = -EAGAIN;
-		goto err_painter;
-	}
-
-	merge_dirty_rects(&painter->dirty_rects[0],
-			  &painter->num_dirts);
-	if (painter->num_dirts > cmd->num_rects)
-		collapse_dirty_rects(&painter->dirty_rects[0],
-				     &painter->num_dirts);
-
-	cmd->num_rects = painter->num_dirts;
-	memcpy(dirty_rects, painter->dirty_rects,
-	       painter->num_dirts * sizeof(painter->dirty_rects[0]));
-
-	efb = painter->scanout_fb;
+	painter_lock(painter);
 
+	efb = evdi_painter_get_frame(head, &rotation, &color,
+				     overlays, &num_overlays);
 	if (!efb) {
 		EVDI_ERROR("Scanout buffer not set\n");
 		err = -EAGAIN;
 		goto err_painter;
 	}
 
-	painter->num_dirts = 0;
+	painter_unlock(painter);
 
-	drm_framebuffer_get(&efb->base);
+	evdi_painter_get_overlays(evdi, overlays, num_overlays);
 
-	crtc = painter->crtc;
-	painter->crtc = NULL;
+	/* Damage and a held vblank stay pending until the frame is rendered */
+	err = evdi_painter_wait_for_render(efb);
+	if (err) {
+		EVDI_DEBUG("(card%d) Scanout buffer not rendered yet: %d\n",
+			   evdi->dev_index, err);
+		goto err_fb;
+	}
 
-	vblank = painter->vblank;
-	painter->vblank = NULL;
+	spin_lock(&painter->vblank_lock);
 
+	cmd->num_rects = evdi_damage_take(&painter->damage, dirty_rects,
+					  min(cmd->num_rects, MAX_DIRTS));
 
-	painter_unlock(painter);
+	vblank = evdi_painter_take_vblank(painter, &crtc);
 
-	if (!efb->obj->vmapping) {
-		if (evdi_gem_vmap(efb->obj) == -ENOMEM) {
-			EVDI_ERROR("Failed to map scanout buffer\n");
-			err = -EFAULT;
-			goto err_fb;
-		}
-		if (!efb->obj->vmapping) {
-			EVDI_ERROR("Inexistent vmapping\n");
-			err = -EFAULT;
-			goto err_fb;
-		}
+	spin_unlock(&painter->vblank_lock);
+
+	if (evdi_vmap_cache_get(&evdi->vmap_cache, efb->obj)) {
+		EVDI_ERROR("Failed to map scanout buffer\n");
+		err = -EFAULT;
+		goto err_fb;
 	}
 
-	if ((unsigned int)cmd->buf_width != efb->base.width ||
-		(unsigned int)cmd->buf_height != efb->base.height) {
+	evdi_fb_rotated_size(&efb->base, rotation, &width, &height);
+	/*
+	 * Chroma rows of NV12 follow the luma rows, so they are only written
+	 * to buffers which declare the rows for them in their height.
+	 */
+	if (efb->base.format->num_planes > 1)
+		buf_height = height + DIV_ROUND_UP(height, efb->base.format->vsub);
+	else
+		buf_height = height;
+	if (cmd->buf_width != width || cmd->buf_height != buf_height) {
 		EVDI_DEBUG("Invalid buffer dimension\n");
 		err = -EINVAL;
-		goto err_fb;
+		goto err_unmap;
 	}
 
 	if (copy_to_user(cmd->rects, dirty_rects,
 		cmd->num_rects * sizeof(cmd->rects[0]))) {
 		err = -EFAULT;
-		goto err_fb;
+		goto err_unmap;
 	}
 
 	import_attach = efb->obj->base.import_attach;
@@ -1157,31 +1922,27 @@ int evdi_painter_grabpix_ioctl(struct drm_device *drm_dev, void *data,
 					       DMA_FROM_DEVICE);
 		if (ret) {
 			err = -EFAULT;
-			goto err_fb;
+			goto err_unmap;
 		}
 	}
 
-	err = copy_primary_pixels(efb,
-				  cmd->buffer,
-				  cmd->buf_byte_stride,
-				  cmd->num_rects,
-				  dirty_rects,
-				  cmd->buf_width,
-				  cmd->buf_height);
-	if (err == 0 && !evdi->cursor_events_enabled)
-		copy_cursor_pixels(efb,
-				   cmd->buffer,
-				   cmd->buf_byte_stride,
-				   evdi->cursor);
+	err = evdi_painter_compose(head, efb, rotation, color,
+				   overlays, num_overlays, &dst,
+				   cmd->num_rects, dirty_rects,
+				   !head->cursor_events_enabled);
 
 	if (import_attach)
 		dma_buf_end_cpu_access(import_attach->dmabuf,
 				       DMA_FROM_DEVICE);
 
+err_unmap:
+	evdi_vmap_cache_put(&evdi->vmap_cache, efb->obj);
 err_fb:
 	evdi_send_vblank(crtc, vblank);
 
+	evdi_painter_put_overlays(evdi, overlays, num_overlays);
 	drm_framebuffer_put(&efb->base);
+	evdi_color_put(color);
 
 	return err;
 
@@ -1190,29 +1951,196 @@ err_painter:
 	return err;
 }
 
+static bool evdi_painter_writeback_format(uint32_t format, uint32_t wb_format)
+{
+	if (format == wb_format)
+		return true;
+	return evdi_fb_is_rgb8888(format) && evdi_fb_is_rgb8888(wb_format) &&
+	       evdi_fb_is_bgr(format) == evdi_fb_is_bgr(wb_format);
+}
+
+/*
+ * Composes the whole frame shown by the head into a writeback framebuffer,
+ * mapped when the writeback job was prepared. Damage is left for grabs.
+ */
+int evdi_painter_writeback(struct evdi_head *head,
+			   struct evdi_framebuffer *wb_efb)
+{
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter = head->painter;
+	struct drm_framebuffer *wb_fb = &wb_efb->base;
+	struct evdi_framebuffer *efb;
+	struct evdi_overlay overlays[EVDI_MAX_OVERLAYS];
+	int num_overlays = 0;
+	const struct evdi_pixel_dst dst = {
+		.kernel = (char *)wb_efb->obj->vmapping + wb_fb->offsets[0],
+		.stride = wb_fb->pitches[0],
+	};
+	struct dma_buf_attachment *import_attach, *wb_import_attach;
+	struct drm_clip_rect rect = { 0, 0, 0, 0 };
+	struct evdi_color *color = NULL;
+	unsigned int rotation;
+	int width, height;
+	int err;
+
+	if (!painter)
+		return -ENODEV;
+
+	painter_lock(painter);
+	efb = evdi_painter_get_frame(head, &rotation, &color,
+				     overlays, &num_overlays);
+	painter_unlock(painter);
+	if (!efb)
+		return -EAGAIN;
+
+	evdi_painter_get_overlays(evdi, overlays, num_overlays);
+
+	evdi_fb_rotated_size(&efb->base, rotation, &width, &height);
+	if (wb_fb->width != width || wb_fb->height != height ||
+	    !evdi_painter_writeback_format(efb->base.format->format,
+					   wb_fb->format->format)) {
+		EVDI_DEBUG("Writeback buffer does not match the scanout\n");
+		err = -EINVAL;
+		goto err_fb;
+	}
+
+	if (evdi_vmap_cache_get(&evdi->vmap_cache, efb->obj)) {
+		EVDI_ERROR("Failed to map scanout buffer\n");
+		err = -EFAULT;
+		goto err_fb;
+	}
+
+	import_attach = efb->obj->base.import_attach;
+	if (import_attach &&
+	    dma_buf_begin_cpu_access(import_attach->dmabuf, DMA_FROM_DEVICE)) {
+		err = -EFAULT;
+		goto err_unmap;
+	}
+	wb_import_attach = wb_efb->obj->base.import_attach;
+	if (wb_import_attach &&
+	    dma_buf_begin_cpu_access(wb_import_attach->dmabuf,
+				     DMA_BIDIRECTIONAL)) {
+		err = -EFAULT;
+		goto err_end_access;
+	}
+
+	rect.x2 = width;
+	rect.y2 = height;
+	err = evdi_painter_compose(head, efb, rotation, color,
+				   overlays, num_overlays, &dst,
+				   1, &rect, true);
+
+	if (wb_import_attach)
+		dma_buf_end_cpu_access(wb_import_attach->dmabuf,
+				       DMA_BIDIRECTIONAL);
+err_end_access:
+	if (import_attach)
+		dma_buf_end_cpu_access(import_attach->dmabuf, DMA_FROM_DEVICE);
+err_unmap:
+	evdi_vmap_cache_put(&evdi->vmap_cache, efb->obj);
+err_fb:
+	evdi_painter_put_overlays(evdi, overlays, num_overlays);
+	drm_framebuffer_put(&efb->base);
+	evdi_color_put(color);
+	return err;
+}
+
+int evdi_painter_grabpix_ioctl(struct drm_device *drm_dev, void *data,
+			       __always_unused struct drm_file *file)
+{
+	struct drm_evdi_grabpix *cmd = data;
+	struct evdi_head *head = evdi_head_get(drm_dev->dev_private, cmd->head);
+
+	if (!head)
+		return -EINVAL;
+
+	return evdi_painter_grab(head, cmd);
+}
+
+static bool evdi_painter_has_damage(struct evdi_painter *painter)
+{
+	return evdi_damage_pending(&painter->damage) > 0 ||
+	       !READ_ONCE(painter->is_connected);
+}
+
+int evdi_painter_wait_and_grab_ioctl(struct drm_device *drm_dev, void *data,
+				     __always_unused struct drm_file *file)
+{
+	struct drm_evdi_wait_and_grab *cmd = data;
+	struct evdi_head *head = evdi_head_get(drm_dev->dev_private, cmd->head);
+	struct evdi_painter *painter = head ? head->painter : NULL;
+	struct drm_evdi_grabpix grab = {
+		.mode = cmd->mode,
+		.buf_width = cmd->buf_width,
+		.buf_height = cmd->buf_height,
+		.buf_byte_stride = cmd->buf_byte_stride,
+		.buffer = cmd->buffer,
+		.num_rects = cmd->num_rects,
+		.rects = cmd->rects,
+		.head = cmd->head,
+	};
+	long timeout;
+	long ret;
+	int err;
+
+	if (!head)
+		return -EINVAL;
+
+	if (!painter)
+		return -ENODEV;
+
+	if (cmd->mode != EVDI_GRABPIX_MODE_DIRTY || cmd->num_rects < 1)
+		return -EINVAL;
+
+	timeout = cmd->timeout_ms < 0 ? MAX_SCHEDULE_TIMEOUT :
+					msecs_to_jiffies(cmd->timeout_ms);
+	ret = wait_event_interruptible_timeout(painter->damage_wait,
+					       evdi_painter_has_damage(painter),
+					       timeout);
+	if (ret < 0)
+		return ret;
+
+	if (!READ_ONCE(painter->is_connected))
+		return -ENODEV;
+
+	if (ret == 0)
+		return -ETIMEDOUT;
+
+	err = evdi_painter_grab(head, &grab);
+	cmd->num_rects = grab.num_rects;
+	return err;
+}
+
 int evdi_painter_request_update_ioctl(struct drm_device *drm_dev,
-				      __always_unused void *data,
+				      void *data,
 				      __always_unused struct drm_file *file)
 {
 	struct evdi_device *evdi = drm_dev->dev_private;
-	struct evdi_painter *painter = evdi->painter;
+	struct drm_evdi_request_update *cmd = data;
+	struct evdi_head *head = evdi_head_get(evdi, cmd->head);
+	struct evdi_painter *painter = head ? head->painter : NULL;
 	int result = 0;
 
-	if (painter) {
-		painter_lock(painter);
+	if (!head)
+		return -EINVAL;
 
-		if (painter->was_update_requested) {
+	if (painter) {
+		if (atomic_xchg(&painter->was_update_requested, 1)) {
 			EVDI_WARN
 			  ("(card%d) Update was already requested - ignoring\n",
 			   evdi->dev_index);
-		} else {
-			if (painter->num_dirts > 0)
-				result = 1;
-			else
-				painter->was_update_requested = true;
+			return 0;
 		}
 
-		painter_unlock(painter);
+		/*
+		 * The request is published before looking for damage, and
+		 * commits add damage before looking for a request, so at least
+		 * one side sees the other. Whoever clears the request owns it.
+		 */
+		smp_mb__after_atomic();
+		if (evdi_damage_pending(&painter->damage) &&
+		    atomic_cmpxchg(&painter->was_update_requested, 1, 0) == 1)
+			result = 1;
 
 		return result;
 	} else {
@@ -1267,6 +2195,7 @@ static void evdi_painter_unregister_from_vt(struct evdi_painter *painter)
 static int evdi_painter_debugfs_measure_copy_fb(void *data, u64 val)
 {
 	struct evdi_painter *painter = (struct evdi_painter *)data;
+	struct evdi_device *evdi = painter->drm_device->dev_private;
 	struct drm_framebuffer *fb;
 	struct evdi_framebuffer *efb;
 	uint32_t dst_buf_size = 0;
@@ -1287,7 +2216,7 @@ static int evdi_painter_debugfs_measure_copy_fb(void *data, u64 val)
 	dst_buf_size = fb->obj[0]->size;
 	dst_mapping.vaddr = vmalloc(dst_buf_size);
 
-	if (evdi_gem_vmap(efb->obj) == -ENOMEM || !efb->obj->vmapping) {
+	if (evdi_vmap_cache_get(&evdi->vmap_cache, efb->obj)) {
 		EVDI_ERROR("Failed to map buffer\n");
 		goto put_fb;
 	}
@@ -1300,7 +2229,7 @@ static int evdi_painter_debugfs_measure_copy_fb(void *data, u64 val)
 	copy_end_time = ktime_get();
 	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
 
-	evdi_gem_vunmap(efb->obj);
+	evdi_vmap_cache_put(&evdi->vmap_cache, efb->obj);
 	vfree(dst_mapping.vaddr);
 	copy_time = ktime_to_ms(copy_end_time - copy_start_time);
 
@@ -1312,32 +2241,81 @@ put_fb:
 }
 
 DEFINE_DEBUGFS_ATTRIBUTE(evdi_painter_debug_test_ops, NULL, evdi_painter_debugfs_measure_copy_fb, "%llu\n");
+
+static int evdi_painter_vblank_stats_show(struct seq_file *m,
+					  __always_unused void *unused)
+{
+	struct evdi_painter *painter = m->private;
+	u64 held_now = 0;
+
+	spin_lock(&painter->vblank_lock);
+	if (painter->vblank)
+		held_now = ktime_to_ns(ktime_sub(ktime_get(),
+					painter->vblank_held_since));
+	seq_printf(m, "held: %llu\n", painter->vblanks_held);
+	seq_printf(m, "timed_out: %llu\n", painter->vblanks_timed_out);
+	seq_printf(m, "held_ns_total: %llu\n", painter->vblank_held_ns_total);
+	seq_printf(m, "held_ns_max: %llu\n", painter->vblank_held_ns_max);
+	seq_printf(m, "held_ns_current: %llu\n", held_now);
+	spin_unlock(&painter->vblank_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(evdi_painter_vblank_stats);
 #endif
 
-int evdi_painter_init(struct evdi_device *dev)
+int evdi_painter_init(struct evdi_head *head)
 {
+	struct evdi_device *evdi = head->evdi;
+	struct evdi_painter *painter;
+
 	EVDI_CHECKPT();
-	dev->painter = kzalloc(sizeof(*dev->painter), GFP_KERNEL);
-	if (dev->painter) {
-		mutex_init(&dev->painter->lock);
-		dev->painter->edid = NULL;
-		dev->painter->edid_length = 0;
-		dev->painter->needs_full_modeset = true;
-		dev->painter->crtc = NULL;
-		dev->painter->vblank = NULL;
-		dev->painter->drm_device = dev->ddev;
-		evdi_painter_register_to_vt(dev->painter);
+	painter = kzalloc(sizeof(*painter), GFP_KERNEL);
+	if (!painter)
+		return -ENOMEM;
+
+	head->painter = painter;
+	painter->head = head;
+	mutex_init(&painter->lock);
+	painter->edid = NULL;
+	painter->edid_length = 0;
+	painter->needs_full_modeset = true;
+	painter->rotation = DRM_MODE_ROTATE_0;
+	painter->crtc = NULL;
+	painter->vblank = NULL;
+	spin_lock_init(&painter->vblank_lock);
+	INIT_LIST_HEAD(&painter->fence_waiters);
+	spin_lock_init(&painter->fence_lock);
+	evdi_damage_init(&painter->damage);
+	painter->drm_device = evdi->ddev;
+	painter->event_mask = EVDI_EVENT_MASK_ALL;
+	evdi_painter_register_to_vt(painter);
 #if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
-		dev->painter->debugfs_measure_copy = debugfs_create_file("measure_copy_fb", 0400, dev->ddev->debugfs_root, dev->painter, &evdi_painter_debug_test_ops);
-#endif
+	/* Head 0 keeps its files in the root, where they were before heads */
+	if (head->index) {
+		char name[16];
 
-		INIT_LIST_HEAD(&dev->painter->pending_events);
-		INIT_DELAYED_WORK(&dev->painter->send_events_work,
-			evdi_send_events_work);
-		init_completion(&dev->painter->ddcci_response_received);
-		return 0;
+		snprintf(name, sizeof(name), "head%u", head->index);
+		painter->debugfs_root = debugfs_create_dir(name,
+						evdi->ddev->debugfs_root);
+	} else {
+		painter->debugfs_root = evdi->ddev->debugfs_root;
 	}
-	return -ENOMEM;
+	painter->debugfs_measure_copy = debugfs_create_file("measure_copy_fb", 0400, painter->debugfs_root, painter, &evdi_painter_debug_test_ops);
+	debugfs_create_file("vblank_stats", 0444, painter->debugfs_root,
+			    painter, &evdi_painter_vblank_stats_fops);
+#endif
+
+	init_waitqueue_head(&painter->damage_wait);
+	INIT_LIST_HEAD(&painter->pending_events);
+	INIT_DELAYED_WORK(&painter->send_events_work,
+		evdi_send_events_work);
+	INIT_DELAYED_WORK(&painter->release_work,
+		evdi_painter_release_work);
+	INIT_DELAYED_WORK(&painter->vblank_timeout_work,
+		evdi_painter_vblank_timeout_work);
+	init_completion(&painter->ddcci_response_received);
+	return 0;
 }
 
 void evdi_painter_cleanup(struct evdi_painter *painter)
@@ -1348,9 +2326,21 @@ void evdi_painter_cleanup(struct evdi_painter *painter)
 		return;
 	}
 
+	/* What is left are works already queued by signalled fences */
+	evdi_painter_cancel_fence_waiters(painter);
+	wait_var_event(&painter->fences_pending,
+		       !atomic_read(&painter->fences_pending));
+	cancel_delayed_work_sync(&painter->release_work);
+	cancel_delayed_work_sync(&painter->vblank_timeout_work);
+
 	painter_lock(painter);
 #if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
-	debugfs_lookup_and_remove("measure_copy_fb", painter->drm_device->debugfs_root);
+	if (painter->debugfs_root != painter->drm_device->debugfs_root) {
+		debugfs_remove_recursive(painter->debugfs_root);
+	} else {
+		debugfs_lookup_and_remove("measure_copy_fb", painter->debugfs_root);
+		debugfs_lookup_and_remove("vblank_stats", painter->debugfs_root);
+	}
 #endif
 	evdi_painter_unregister_from_vt(painter);
 	kfree(painter->edid);
@@ -1359,6 +2349,10 @@ void evdi_painter_cleanup(struct evdi_painter *painter)
 	if (painter->scanout_fb)
 		drm_framebuffer_put(&painter->scanout_fb->base);
 	painter->scanout_fb = NULL;
+	evdi_painter_clear_overlays(painter);
+	evdi_color_put(painter->color);
+	painter->color = NULL;
+	evdi_damage_set_size(&painter->damage, 0, 0);
 
 	evdi_painter_send_vblank(painter);
 
@@ -1370,9 +2364,11 @@ void evdi_painter_cleanup(struct evdi_painter *painter)
 }
 
 void evdi_painter_set_scanout_buffer(struct evdi_painter *painter,
-				     struct evdi_framebuffer *newfb)
+				     struct evdi_framebuffer *newfb,
+				     unsigned int rotation)
 {
 	struct evdi_framebuffer *oldfb = NULL;
+	int width, height;
 
 	if (newfb)
 		drm_framebuffer_get(&newfb->base);
@@ -1381,13 +2377,51 @@ void evdi_painter_set_scanout_buffer(struct evdi_painter *painter,
 
 	oldfb = painter->scanout_fb;
 	painter->scanout_fb = newfb;
+	WRITE_ONCE(painter->rotation, rotation);
+	if (newfb) {
+		evdi_fb_rotated_size(&newfb->base, rotation, &width, &height);
+		evdi_damage_set_size(&painter->damage, width, height);
+	} else {
+		evdi_damage_set_size(&painter->damage, 0, 0);
+	}
+
+	painter_unlock(painter);
+
+	if (oldfb)
+		drm_framebuffer_put(&oldfb->base);
+}
+
+void evdi_painter_set_overlay(struct evdi_painter *painter, unsigned int index,
+			      const struct evdi_overlay *overlay)
+{
+	struct evdi_framebuffer *oldfb = NULL;
 
+	if (overlay->efb)
+		drm_framebuffer_get(&overlay->efb->base);
+
+	painter_lock(painter);
+	oldfb = painter->overlays[index].efb;
+	painter->overlays[index] = *overlay;
 	painter_unlock(painter);
 
 	if (oldfb)
 		drm_framebuffer_put(&oldfb->base);
 }
 
+/* Takes over the reference to the color management passed in */
+void evdi_painter_set_color(struct evdi_painter *painter,
+			    struct evdi_color *color)
+{
+	struct evdi_color *old_color;
+
+	painter_lock(painter);
+	old_color = painter->color;
+	painter->color = color;
+	painter_unlock(painter);
+
+	evdi_color_put(old_color);
+}
+
 bool evdi_painter_needs_full_modeset(struct evdi_painter *painter)
 {
 	return painter ? painter->needs_full_modeset : false;
@@ -1472,6 +2506,11 @@ bool evdi_painter_i2c_data_notify(struct evdi_painter *painter, struct i2c_msg *
 		return false;
 	}
 
+	if (!evdi_painter_wants_event(painter, DRM_EVDI_EVENT_DDCCI_DATA)) {
+		EVDI_VERBOSE("Ignored ddc/ci data, client is not subscribed\n");
+		return false;
+	}
+
 	evdi_painter_ddcci_data(painter, msg);
 	return true;
 }
@@ -1479,11 +2518,14 @@ bool evdi_painter_i2c_data_notify(struct evdi_painter *painter, struct i2c_msg *
 int evdi_painter_ddcci_response_ioctl(struct drm_device *drm_dev, void *data,
 				__always_unused struct drm_file *file)
 {
-	struct evdi_device *evdi = drm_dev->dev_private;
-	struct evdi_painter *painter = evdi->painter;
 	struct drm_evdi_ddcci_response *cmd = data;
+	struct evdi_head *head = evdi_head_get(drm_dev->dev_private, cmd->head);
+	struct evdi_painter *painter = head ? head->painter : NULL;
 	int result = 0;
 
+	if (!painter)
+		return -EINVAL;
+
 	painter_lock(painter);
 
 	// Truncate any read to 64 bytes
@@ -1517,10 +2559,44 @@ unlock:
 int evdi_painter_enable_cursor_events_ioctl(struct drm_device *drm_dev, void *data,
 					__always_unused struct drm_file *file)
 {
-	struct evdi_device *evdi = drm_dev->dev_private;
 	struct drm_evdi_enable_cursor_events *cmd = data;
+	struct evdi_head *head = evdi_head_get(drm_dev->dev_private, cmd->head);
+
+	if (!head)
+		return -EINVAL;
 
-	evdi->cursor_events_enabled = cmd->enable;
+	head->cursor_events_enabled = cmd->enable;
 
 	return 0;
 }
+
+int evdi_painter_set_event_mask_ioctl(struct drm_device *drm_dev, void *data,
+				      struct drm_file *file)
+{
+	struct evdi_device *evdi = drm_dev->dev_private;
+	struct drm_evdi_set_event_mask *cmd = data;
+	struct evdi_head *head = evdi_head_get(evdi, cmd->head);
+	struct evdi_painter *painter = head ? head->painter : NULL;
+	int result = 0;
+
+	if (!head)
+		return -EINVAL;
+
+	if (!painter)
+		return -ENODEV;
+
+	painter_lock(painter);
+
+	if (painter->drm_filp != file) {
+		EVDI_DEBUG("(card%d) Event mask can only be set by connected client\n",
+			   evdi->dev_index);
+		result = -EACCES;
+	} else {
+		EVDI_DEBUG("(card%d) Event mask set to 0x%08x\n",
+			   evdi->dev_index, cmd->mask);
+		WRITE_ONCE(painter->event_mask, cmd->mask);
+	}
+
+	painter_unlock(painter);
+	return result;
+}
@@ -15,6 +15,18 @@
 
 unsigned int evdi_loglevel __read_mostly = EVDI_LOGLEVEL_INFO;
 unsigned short int evdi_initial_device_count __read_mostly;
+unsigned int evdi_huge_pages_threshold_kb __read_mostly = 8192;
+/* Three buffers of the largest mode, 7680x4320 at 4 bytes per pixel */
+unsigned int evdi_vmap_cache_mb __read_mostly = 384;
+unsigned int evdi_gem_pool_mb __read_mostly = 128;
+bool evdi_gem_pool_zero __read_mostly = true;
+unsigned int evdi_mmap_fault_around_kb __read_mostly = 1024;
+bool evdi_mmap_populate __read_mostly;
+unsigned int evdi_idle_release_ms __read_mostly = 10000;
+bool evdi_export_write_combined __read_mostly = true;
+bool evdi_vblank_timer __read_mostly = true;
+unsigned int evdi_heads_per_device __read_mostly = 1;
+unsigned int evdi_overlay_planes __read_mostly = 1;
 
 module_param_named(initial_loglevel, evdi_loglevel, int, 0400);
 MODULE_PARM_DESC(initial_loglevel, "Initial log level");
@@ -23,3 +35,47 @@ module_param_named(initial_device_count,
 		   evdi_initial_device_count, ushort, 0644);
 MODULE_PARM_DESC(initial_device_count, "Initial DRM device count (default: 0)");
 
+module_param_named(huge_pages_threshold_kb,
+		   evdi_huge_pages_threshold_kb, uint, 0644);
+MODULE_PARM_DESC(huge_pages_threshold_kb,
+		 "Back buffers of at least this size with huge pages, 0 disables (default: 8192)");
+
+module_param_named(vmap_cache_mb, evdi_vmap_cache_mb, uint, 0644);
+MODULE_PARM_DESC(vmap_cache_mb,
+		 "Size of idle scanout buffer mappings kept per device in MiB (default: 384)");
+
+module_param_named(gem_pool_mb, evdi_gem_pool_mb, uint, 0644);
+MODULE_PARM_DESC(gem_pool_mb,
+		 "Size of freed buffers kept for reuse in MiB, 0 disables (default: 128)");
+
+module_param_named(gem_pool_zero, evdi_gem_pool_zero, bool, 0644);
+MODULE_PARM_DESC(gem_pool_zero,
+		 "Clear reused buffers before handing them out (default: true)");
+
+module_param_named(mmap_fault_around_kb, evdi_mmap_fault_around_kb, uint, 0644);
+MODULE_PARM_DESC(mmap_fault_around_kb,
+		 "Size of buffer mapped on a single page fault in KiB (default: 1024)");
+
+module_param_named(mmap_populate, evdi_mmap_populate, bool, 0644);
+MODULE_PARM_DESC(mmap_populate,
+		 "Map whole buffers up front on mmap instead of on page faults (default: false)");
+
+module_param_named(idle_release_ms, evdi_idle_release_ms, uint, 0644);
+MODULE_PARM_DESC(idle_release_ms,
+		 "Release buffer mappings of displays off or disconnected for this long, 0 disables (default: 10000)");
+
+module_param_named(export_write_combined, evdi_export_write_combined, bool, 0644);
+MODULE_PARM_DESC(export_write_combined,
+		 "Map exported buffers write-combined rather than cached for the CPU (default: true)");
+
+module_param_named(vblank_timer, evdi_vblank_timer, bool, 0444);
+MODULE_PARM_DESC(vblank_timer,
+		 "Deliver vblank events at the refresh rate of the mode instead of immediately (default: true)");
+
+module_param_named(heads_per_device, evdi_heads_per_device, uint, 0644);
+MODULE_PARM_DESC(heads_per_device,
+		 "Number of CRTC and connector pairs of devices added from now on, up to 16 (default: 1)");
+
+module_param_named(overlay_planes, evdi_overlay_planes, uint, 0644);
+MODULE_PARM_DESC(overlay_planes,
+		 "Number of overlay planes per CRTC of devices added from now on, up to 4 (default: 1)");
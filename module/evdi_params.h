@@ -11,5 +11,16 @@
 
 extern unsigned int evdi_loglevel;
 extern unsigned short int evdi_initial_device_count;
+extern unsigned int evdi_huge_pages_threshold_kb;
+extern unsigned int evdi_vmap_cache_mb;
+extern unsigned int evdi_gem_pool_mb;
+extern bool evdi_gem_pool_zero;
+extern unsigned int evdi_mmap_fault_around_kb;
+extern bool evdi_mmap_populate;
+extern unsigned int evdi_idle_release_ms;
+extern bool evdi_export_write_combined;
+extern bool evdi_vblank_timer;
+extern unsigned int evdi_heads_per_device;
+extern unsigned int evdi_overlay_planes;
 
 #endif /* EVDI_PARAMS_H */
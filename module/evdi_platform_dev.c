@@ -21,6 +21,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
+#include <linux/nodemask.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
 
 #include "evdi_platform_drv.h"
 #include "evdi_debug.h"
@@ -53,6 +56,236 @@ void evdi_platform_dev_destroy(struct platform_device *dev)
 	EVDI_INFO("Evdi platform_device destroy\n");
 }
 
+static ssize_t numa_node_affinity_show(struct device *dev,
+				       __always_unused struct device_attribute *attr,
+				       char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(evdi->numa_node));
+}
+
+static ssize_t numa_node_affinity_store(struct device *dev,
+					__always_unused struct device_attribute *attr,
+					const char *buf,
+					size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	int node;
+
+	if (kstrtoint(buf, 10, &node))
+		return -EINVAL;
+
+	if (node != NUMA_NO_NODE &&
+	    (node < 0 || node >= nr_node_ids || !node_online(node))) {
+		EVDI_ERROR("Invalid NUMA node %d\n", node);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(evdi->numa_node, node);
+	return count;
+}
+
+static ssize_t pitch_alignment_show(struct device *dev,
+				    __always_unused struct device_attribute *attr,
+				    char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(evdi->pitch_align));
+}
+
+static ssize_t pitch_alignment_store(struct device *dev,
+				     __always_unused struct device_attribute *attr,
+				     const char *buf,
+				     size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	unsigned int align;
+
+	if (kstrtouint(buf, 10, &align))
+		return -EINVAL;
+
+	if (align && (!is_power_of_2(align) || align < 4 || align > SZ_4K)) {
+		EVDI_ERROR("Invalid pitch alignment %u\n", align);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(evdi->pitch_align, align);
+	return count;
+}
+
+static ssize_t pitch_stagger_show(struct device *dev,
+				  __always_unused struct device_attribute *attr,
+				  char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(evdi->pitch_stagger));
+}
+
+static ssize_t pitch_stagger_store(struct device *dev,
+				   __always_unused struct device_attribute *attr,
+				   const char *buf,
+				   size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	bool stagger;
+
+	if (kstrtobool(buf, &stagger))
+		return -EINVAL;
+
+	WRITE_ONCE(evdi->pitch_stagger, stagger);
+	return count;
+}
+
+static const char * const evdi_flip_policy_names[] = {
+	[EVDI_FLIP_BLOCK] = "block",
+	[EVDI_FLIP_TIMEOUT] = "timeout",
+	[EVDI_FLIP_IMMEDIATE] = "immediate",
+};
+
+static ssize_t flip_policy_show(struct device *dev,
+				__always_unused struct device_attribute *attr,
+				char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+			evdi_flip_policy_names[READ_ONCE(evdi->flip_policy)]);
+}
+
+static ssize_t flip_policy_store(struct device *dev,
+				 __always_unused struct device_attribute *attr,
+				 const char *buf,
+				 size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	int policy = sysfs_match_string(evdi_flip_policy_names, buf);
+
+	if (policy < 0) {
+		EVDI_ERROR("Invalid flip policy\n");
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(evdi->flip_policy, policy);
+	return count;
+}
+
+static ssize_t flip_timeout_ms_show(struct device *dev,
+				    __always_unused struct device_attribute *attr,
+				    char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(evdi->flip_timeout_ms));
+}
+
+static ssize_t flip_timeout_ms_store(struct device *dev,
+				     __always_unused struct device_attribute *attr,
+				     const char *buf,
+				     size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	unsigned int timeout;
+
+	if (kstrtouint(buf, 10, &timeout))
+		return -EINVAL;
+
+	WRITE_ONCE(evdi->flip_timeout_ms, timeout);
+	return count;
+}
+
+static ssize_t vrr_range_show(struct device *dev,
+			      __always_unused struct device_attribute *attr,
+			      char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%u-%u\n", READ_ONCE(evdi->vrr_min_hz),
+			READ_ONCE(evdi->vrr_max_hz));
+}
+
+static ssize_t vrr_range_store(struct device *dev,
+			       __always_unused struct device_attribute *attr,
+			       const char *buf,
+			       size_t count)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+	unsigned int min_hz = 0, max_hz = 0;
+
+	if (sscanf(buf, "%u-%u", &min_hz, &max_hz) != 2 &&
+	    !sysfs_streq(buf, "0"))
+		return -EINVAL;
+
+	if (max_hz < min_hz || (max_hz && !min_hz)) {
+		EVDI_ERROR("Invalid refresh range %u-%u\n", min_hz, max_hz);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(evdi->vrr_min_hz, min_hz);
+	WRITE_ONCE(evdi->vrr_max_hz, max_hz);
+	return count;
+}
+
+static ssize_t heads_show(struct device *dev,
+			  __always_unused struct device_attribute *attr,
+			  char *buf)
+{
+	struct evdi_platform_device_data *data = dev_get_drvdata(dev);
+	struct evdi_device *evdi = data->drm_dev->dev_private;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", evdi->num_heads);
+}
+
+static struct device_attribute evdi_numa_node_attribute =
+	__ATTR_RW(numa_node_affinity);
+static struct device_attribute evdi_pitch_alignment_attribute =
+	__ATTR_RW(pitch_alignment);
+static struct device_attribute evdi_pitch_stagger_attribute =
+	__ATTR_RW(pitch_stagger);
+static struct device_attribute evdi_flip_policy_attribute =
+	__ATTR_RW(flip_policy);
+static struct device_attribute evdi_flip_timeout_attribute =
+	__ATTR_RW(flip_timeout_ms);
+static struct device_attribute evdi_vrr_range_attribute =
+	__ATTR_RW(vrr_range);
+static struct device_attribute evdi_heads_attribute =
+	__ATTR_RO(heads);
+
+static struct attribute *evdi_platform_device_attrs[] = {
+	&evdi_numa_node_attribute.attr,
+	&evdi_pitch_alignment_attribute.attr,
+	&evdi_pitch_stagger_attribute.attr,
+	&evdi_flip_policy_attribute.attr,
+	&evdi_flip_timeout_attribute.attr,
+	&evdi_vrr_range_attribute.attr,
+	&evdi_heads_attribute.attr,
+	NULL,
+};
+
+static const struct attribute_group evdi_platform_device_group = {
+	.attrs = evdi_platform_device_attrs,
+};
+
+/* Created by the driver core once probe succeeds, before it is announced */
+const struct attribute_group *evdi_platform_device_groups[] = {
+	&evdi_platform_device_group,
+	NULL,
+};
+
 int evdi_platform_device_probe(struct platform_device *pdev)
 {
 	struct drm_device *dev;
@@ -78,6 +311,10 @@ int evdi_platform_device_probe(struct platform_device *pdev)
 	data->drm_dev = dev;
 	data->symlinked = false;
 	platform_set_drvdata(pdev, data);
+#if KERNEL_VERSION(5, 4, 0) > LINUX_VERSION_CODE
+	if (sysfs_create_groups(&pdev->dev.kobj, evdi_platform_device_groups))
+		EVDI_WARN("Failed to create device attributes\n");
+#endif
 	return PTR_ERR_OR_ZERO(dev);
 
 err_free:
@@ -96,6 +333,9 @@ int evdi_platform_device_remove(struct platform_device *pdev)
 
 	EVDI_CHECKPT();
 
+#if KERNEL_VERSION(5, 4, 0) > LINUX_VERSION_CODE
+	sysfs_remove_groups(&pdev->dev.kobj, evdi_platform_device_groups);
+#endif
 	evdi_drm_device_remove(data->drm_dev);
 	kfree(data);
 /* Need to return int for EL9 kernels */
@@ -109,11 +349,15 @@ bool evdi_platform_device_is_free(struct platform_device *pdev)
 {
 	struct evdi_platform_device_data *data = platform_get_drvdata(pdev);
 	struct evdi_device *evdi = data->drm_dev->dev_private;
+	unsigned int i;
+
+	if (!evdi || data->symlinked)
+		return false;
 
-	if (evdi && !evdi_painter_is_connected(evdi->painter) &&
-	    !data->symlinked)
-		return true;
-	return false;
+	for (i = 0; i < evdi->num_heads; ++i)
+		if (evdi_painter_is_connected(evdi->heads[i].painter))
+			return false;
+	return true;
 }
 
 void evdi_platform_device_link(struct platform_device *pdev,
@@ -137,6 +381,8 @@ void evdi_platform_device_link(struct platform_device *pdev,
 	} else {
 		data->symlinked = true;
 		data->parent = parent;
+		/* Buffers follow the node of the device they are displayed on */
+		set_dev_node(&pdev->dev, dev_to_node(parent));
 	}
 }
 
@@ -149,6 +395,7 @@ void evdi_platform_device_unlink_if_linked_with(struct platform_device *pdev,
 		sysfs_remove_link(&pdev->dev.kobj, "device");
 		data->symlinked = false;
 		data->parent = NULL;
+		set_dev_node(&pdev->dev, NUMA_NO_NODE);
 		EVDI_INFO("Detached from parent device\n");
 	}
 }
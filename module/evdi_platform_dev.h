@@ -27,6 +27,9 @@ struct platform_device_info;
 struct platform_device;
 struct drm_driver;
 struct device;
+struct attribute_group;
+
+extern const struct attribute_group *evdi_platform_device_groups[];
 
 struct platform_device *evdi_platform_dev_create(struct platform_device_info *info);
 void evdi_platform_dev_destroy(struct platform_device *dev);
@@ -21,6 +21,8 @@
 #include "evdi_platform_drv.h"
 #include "evdi_platform_dev.h"
 #include "evdi_sysfs.h"
+#include "evdi_drm_drv.h"
+#include "evdi_gem_pool.h"
 
 MODULE_AUTHOR("DisplayLink (UK) Ltd.");
 MODULE_DESCRIPTION("Extensible Virtual Display Interface");
@@ -207,6 +209,9 @@ static struct platform_driver evdi_platform_driver = {
 		   .name = DRIVER_NAME,
 		   .mod_name = KBUILD_MODNAME,
 		   .owner = THIS_MODULE,
+#if KERNEL_VERSION(5, 4, 0) <= LINUX_VERSION_CODE
+		   .dev_groups = evdi_platform_device_groups,
+#endif
 	}
 };
 
@@ -217,6 +222,10 @@ static int __init evdi_init(void)
 	EVDI_INFO("Initialising logging on level %u\n", evdi_loglevel);
 	EVDI_INFO("Atomic driver: yes\n");
 
+	ret = evdi_gem_pool_init();
+	if (ret)
+		return ret;
+
 	memset(&g_ctx, 0, sizeof(g_ctx));
 	g_ctx.root_dev = root_device_register(DRIVER_NAME);
 #ifdef CONFIG_USB_SUPPORT
@@ -229,15 +238,36 @@ static int __init evdi_init(void)
 	usb_register_notify(&g_ctx.usb_notifier);
 #endif
 	evdi_sysfs_init(g_ctx.root_dev);
+	evdi_gem_huge_mnt_init();
 	ret = platform_driver_register(&evdi_platform_driver);
 	if (ret)
-		return ret;
+		goto err_cleanup;
 
-	if (evdi_initial_device_count)
-		return evdi_platform_add_devices(
-			g_ctx.root_dev, evdi_initial_device_count);
+	if (evdi_initial_device_count) {
+		ret = evdi_platform_add_devices(g_ctx.root_dev,
+						evdi_initial_device_count);
+		if (ret)
+			goto err_unregister;
+	}
 
 	return 0;
+
+err_unregister:
+	evdi_platform_remove_all_devices(g_ctx.root_dev);
+	platform_driver_unregister(&evdi_platform_driver);
+err_cleanup:
+	evdi_gem_pool_cleanup();
+	evdi_gem_huge_mnt_cleanup();
+	/* evdi_exit does not run when loading fails */
+	if (!PTR_ERR_OR_ZERO(g_ctx.root_dev)) {
+		evdi_sysfs_exit(g_ctx.root_dev);
+#ifdef CONFIG_USB_SUPPORT
+		usb_unregister_notify(&g_ctx.usb_notifier);
+#endif
+		dev_set_drvdata(g_ctx.root_dev, NULL);
+		root_device_unregister(g_ctx.root_dev);
+	}
+	return ret;
 }
 
 static void __exit evdi_exit(void)
@@ -245,6 +275,8 @@ static void __exit evdi_exit(void)
 	EVDI_CHECKPT();
 	evdi_platform_remove_all_devices(g_ctx.root_dev);
 	platform_driver_unregister(&evdi_platform_driver);
+	evdi_gem_pool_cleanup();
+	evdi_gem_huge_mnt_cleanup();
 
 	if (!PTR_ERR_OR_ZERO(g_ctx.root_dev)) {
 		evdi_sysfs_exit(g_ctx.root_dev);
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/sizes.h>
+#include "evdi_vmap_cache.h"
+#include "evdi_drm_drv.h"
+#include "evdi_params.h"
+#include "evdi_debug.h"
+
+static void evdi_vmap_cache_unmap(struct evdi_vmap_cache *cache,
+				  struct evdi_gem_object *obj)
+{
+	list_del_init(&obj->vmap_lru);
+	cache->mapped -= obj->base.size;
+	if (!obj->vmap_users)
+		cache->idle -= obj->base.size;
+
+	if (obj->vmapping)
+		evdi_gem_vunmap(obj);
+}
+
+static void evdi_vmap_cache_shrink(struct evdi_vmap_cache *cache, size_t budget)
+{
+	struct evdi_gem_object *obj, *tmp;
+
+	list_for_each_entry_safe_reverse(obj, tmp, &cache->lru, vmap_lru) {
+		if (cache->mapped <= budget)
+			break;
+		if (obj->vmap_users)
+			continue;
+
+		evdi_vmap_cache_unmap(cache, obj);
+		cache->evictions++;
+	}
+}
+
+/*
+ * Only mappings whose release gives memory back are worth unmapping under
+ * pressure. Native buffers pinned by anything but their mapping, e.g. a
+ * client mmap, keep all their pages when unmapped. Imports are never
+ * unmapped from reclaim, as dma_buf_vunmap takes the reservation lock,
+ * which exporters may hold while allocating.
+ */
+static bool evdi_vmap_cache_reclaimable(struct evdi_gem_object *obj)
+{
+	return !obj->vmap_users && evdi_gem_vunmap_releases_pages(obj);
+}
+
+static unsigned long evdi_vmap_cache_count(struct shrinker *shrinker,
+					   __always_unused struct shrink_control *sc)
+{
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	struct evdi_vmap_cache *cache = shrinker->private_data;
+#else
+	struct evdi_vmap_cache *cache =
+		container_of(shrinker, struct evdi_vmap_cache, shrinker);
+#endif
+	struct evdi_gem_object *obj;
+	size_t reclaimable = 0;
+
+	if (!READ_ONCE(cache->idle) || !mutex_trylock(&cache->lock))
+		return SHRINK_EMPTY;
+
+	list_for_each_entry(obj, &cache->lru, vmap_lru)
+		if (evdi_vmap_cache_reclaimable(obj))
+			reclaimable += obj->base.size;
+	mutex_unlock(&cache->lock);
+
+	return reclaimable ? reclaimable >> PAGE_SHIFT : SHRINK_EMPTY;
+}
+
+static unsigned long evdi_vmap_cache_scan(struct shrinker *shrinker,
+					  struct shrink_control *sc)
+{
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	struct evdi_vmap_cache *cache = shrinker->private_data;
+#else
+	struct evdi_vmap_cache *cache =
+		container_of(shrinker, struct evdi_vmap_cache, shrinker);
+#endif
+	const size_t to_free = (size_t)sc->nr_to_scan << PAGE_SHIFT;
+	struct evdi_gem_object *obj, *tmp;
+	size_t freed = 0;
+
+	if (!mutex_trylock(&cache->lock))
+		return SHRINK_STOP;
+
+	list_for_each_entry_safe_reverse(obj, tmp, &cache->lru, vmap_lru) {
+		if (freed >= to_free)
+			break;
+		if (!evdi_vmap_cache_reclaimable(obj))
+			continue;
+
+		freed += obj->base.size;
+		evdi_vmap_cache_unmap(cache, obj);
+		cache->evictions++;
+	}
+	mutex_unlock(&cache->lock);
+
+	return freed ? freed >> PAGE_SHIFT : SHRINK_STOP;
+}
+
+int evdi_vmap_cache_init(struct evdi_vmap_cache *cache, int dev_index)
+{
+	memset(cache, 0, sizeof(*cache));
+	mutex_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->lru);
+
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	cache->shrinker = shrinker_alloc(0, "evdi-vmap-card%d", dev_index);
+	if (!cache->shrinker) {
+		mutex_destroy(&cache->lock);
+		return -ENOMEM;
+	}
+
+	cache->shrinker->count_objects = evdi_vmap_cache_count;
+	cache->shrinker->scan_objects = evdi_vmap_cache_scan;
+	cache->shrinker->private_data = cache;
+	shrinker_register(cache->shrinker);
+	return 0;
+#else
+	cache->shrinker.count_objects = evdi_vmap_cache_count;
+	cache->shrinker.scan_objects = evdi_vmap_cache_scan;
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+# if KERNEL_VERSION(6, 0, 0) <= LINUX_VERSION_CODE
+	return register_shrinker(&cache->shrinker, "evdi-vmap-card%d", dev_index);
+# else
+	return register_shrinker(&cache->shrinker);
+# endif
+#endif
+}
+
+/* Unmaps everything not in use */
+void evdi_vmap_cache_trim(struct evdi_vmap_cache *cache)
+{
+	mutex_lock(&cache->lock);
+	evdi_vmap_cache_shrink(cache, 0);
+	mutex_unlock(&cache->lock);
+}
+
+void evdi_vmap_cache_cleanup(struct evdi_vmap_cache *cache)
+{
+	struct evdi_gem_object *obj, *tmp;
+
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	shrinker_free(cache->shrinker);
+	cache->shrinker = NULL;
+#else
+	unregister_shrinker(&cache->shrinker);
+#endif
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry_safe(obj, tmp, &cache->lru, vmap_lru) {
+		if (obj->vmap_users)
+			EVDI_WARN("Mapping of %p still in use\n", obj);
+		evdi_vmap_cache_unmap(cache, obj);
+	}
+	mutex_unlock(&cache->lock);
+	mutex_destroy(&cache->lock);
+}
+
+/*
+ * Makes obj->vmapping valid until the matching evdi_vmap_cache_put.
+ * Buffers already mapped elsewhere, e.g. by fbdev, are used as they are
+ * and never unmapped by the cache.
+ */
+int evdi_vmap_cache_get(struct evdi_vmap_cache *cache,
+			struct evdi_gem_object *obj)
+{
+	ktime_t start;
+	u64 map_ns;
+	int ret;
+
+	mutex_lock(&cache->lock);
+	if (!list_empty(&obj->vmap_lru)) {
+		list_move(&obj->vmap_lru, &cache->lru);
+		if (obj->vmap_users++ == 0)
+			cache->idle -= obj->base.size;
+		cache->hits++;
+		goto unlock;
+	}
+
+	if (obj->vmapping) {
+		cache->hits++;
+		goto unlock;
+	}
+
+	start = ktime_get();
+	ret = evdi_gem_vmap(obj);
+	if (ret || !obj->vmapping) {
+		mutex_unlock(&cache->lock);
+		return ret ? ret : -EFAULT;
+	}
+	map_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	cache->misses++;
+	cache->map_ns_total += map_ns;
+	cache->map_ns_max = max(cache->map_ns_max, map_ns);
+
+	list_add(&obj->vmap_lru, &cache->lru);
+	obj->vmap_users = 1;
+	cache->mapped += obj->base.size;
+
+	evdi_vmap_cache_shrink(cache, (size_t)evdi_vmap_cache_mb * SZ_1M);
+unlock:
+	mutex_unlock(&cache->lock);
+	return 0;
+}
+
+void evdi_vmap_cache_put(struct evdi_vmap_cache *cache,
+			 struct evdi_gem_object *obj)
+{
+	mutex_lock(&cache->lock);
+	if (!list_empty(&obj->vmap_lru) && !WARN_ON(!obj->vmap_users)) {
+		if (--obj->vmap_users == 0)
+			cache->idle += obj->base.size;
+		evdi_vmap_cache_shrink(cache, (size_t)evdi_vmap_cache_mb * SZ_1M);
+	}
+	mutex_unlock(&cache->lock);
+}
+
+/* Called when the object is freed, unmaps it if the cache mapped it */
+void evdi_vmap_cache_remove(struct evdi_vmap_cache *cache,
+			    struct evdi_gem_object *obj)
+{
+	mutex_lock(&cache->lock);
+	if (!list_empty(&obj->vmap_lru))
+		evdi_vmap_cache_unmap(cache, obj);
+	mutex_unlock(&cache->lock);
+}
+
+static int evdi_vmap_cache_stats_show(struct seq_file *m,
+				      __always_unused void *unused)
+{
+	struct evdi_vmap_cache *cache = m->private;
+	struct evdi_gem_object *obj;
+	unsigned int entries = 0;
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry(obj, &cache->lru, vmap_lru)
+		entries++;
+
+	seq_printf(m, "entries: %u\n", entries);
+	seq_printf(m, "mapped_bytes: %zu\n", cache->mapped);
+	seq_printf(m, "idle_bytes: %zu\n", cache->idle);
+	seq_printf(m, "hits: %llu\n", cache->hits);
+	seq_printf(m, "misses: %llu\n", cache->misses);
+	seq_printf(m, "evictions: %llu\n", cache->evictions);
+	seq_printf(m, "map_ns_avg: %llu\n",
+		   cache->misses ? div64_u64(cache->map_ns_total, cache->misses) : 0);
+	seq_printf(m, "map_ns_max: %llu\n", cache->map_ns_max);
+	mutex_unlock(&cache->lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(evdi_vmap_cache_stats);
+
+void evdi_vmap_cache_debugfs_init(struct evdi_vmap_cache *cache,
+				  struct dentry *root)
+{
+	debugfs_create_file("vmap_cache", 0444, root, cache,
+			    &evdi_vmap_cache_stats_fops);
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-only
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#ifndef EVDI_VMAP_CACHE_H
+#define EVDI_VMAP_CACHE_H
+
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/types.h>
+#include <linux/version.h>
+
+struct dentry;
+struct evdi_gem_object;
+
+/*
+ * Kernel mappings of buffers grabbed from, kept in least recently used
+ * order. Mappings not in use are released once the mapped size exceeds
+ * the vmap_cache_mb budget, under memory pressure, or when the display
+ * stays off.
+ */
+struct evdi_vmap_cache {
+	struct mutex lock;
+	struct list_head lru;
+	size_t mapped;
+	size_t idle;
+#if KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE
+	struct shrinker *shrinker;
+#else
+	struct shrinker shrinker;
+#endif
+
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u64 map_ns_total;
+	u64 map_ns_max;
+};
+
+int evdi_vmap_cache_init(struct evdi_vmap_cache *cache, int dev_index);
+void evdi_vmap_cache_cleanup(struct evdi_vmap_cache *cache);
+void evdi_vmap_cache_trim(struct evdi_vmap_cache *cache);
+int evdi_vmap_cache_get(struct evdi_vmap_cache *cache,
+			struct evdi_gem_object *obj);
+void evdi_vmap_cache_put(struct evdi_vmap_cache *cache,
+			 struct evdi_gem_object *obj);
+void evdi_vmap_cache_remove(struct evdi_vmap_cache *cache,
+			    struct evdi_gem_object *obj);
+void evdi_vmap_cache_debugfs_init(struct evdi_vmap_cache *cache,
+				  struct dentry *root);
+
+#endif /* EVDI_VMAP_CACHE_H */
@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+#include <linux/version.h>
+#if KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <drm/drm_atomic.h>
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_edid.h>
+#include <drm/drm_probe_helper.h>
+#include <drm/drm_writeback.h>
+#include "evdi_drm_drv.h"
+
+/*
+ * A writeback connector per CRTC. Clients attach a framebuffer as
+ * WRITEBACK_FB_ID and the frame shown on the CRTC is composed into it on
+ * the commit worker, signalling the out-fence once it is filled.
+ */
+struct evdi_writeback {
+	struct drm_writeback_connector base;
+	struct evdi_head *head;
+};
+
+struct evdi_writeback_work {
+	struct work_struct work;
+	struct evdi_writeback *writeback;
+	struct evdi_framebuffer *efb;
+};
+
+#define to_evdi_writeback(x) \
+	container_of(drm_connector_to_writeback(x), struct evdi_writeback, base)
+
+/* Formats a scanout buffer can be composed into without conversion */
+static const u32 evdi_writeback_formats[] = {
+	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_XRGB2101010,
+};
+
+static void evdi_writeback_work_fn(struct work_struct *work)
+{
+	struct evdi_writeback_work *wb_work =
+		container_of(work, struct evdi_writeback_work, work);
+	struct evdi_writeback *writeback = wb_work->writeback;
+	int err;
+
+	err = evdi_painter_writeback(writeback->head, wb_work->efb);
+	if (err)
+		EVDI_DEBUG("(card%d) Writeback failed: %d\n",
+			   writeback->head->evdi->dev_index, err);
+
+	/* Jobs complete in the order they were queued, like this worker */
+	drm_writeback_signal_completion(&writeback->base, err);
+	kfree(wb_work);
+}
+
+static int evdi_writeback_get_modes(struct drm_connector *connector)
+{
+	const struct drm_mode_config *config = &connector->dev->mode_config;
+
+	return drm_add_modes_noedid(connector, config->max_width,
+				    config->max_height);
+}
+
+static int evdi_writeback_prepare_job(struct drm_writeback_connector *connector,
+				      struct drm_writeback_job *job)
+{
+	struct evdi_device *evdi = connector->base.dev->dev_private;
+
+	if (!job->fb)
+		return 0;
+
+	if (evdi_vmap_cache_get(&evdi->vmap_cache, to_evdi_fb(job->fb)->obj)) {
+		EVDI_ERROR("Failed to map writeback buffer\n");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static void evdi_writeback_cleanup_job(struct drm_writeback_connector *connector,
+				       struct drm_writeback_job *job)
+{
+	struct evdi_device *evdi = connector->base.dev->dev_private;
+
+	if (job->fb)
+		evdi_vmap_cache_put(&evdi->vmap_cache,
+				    to_evdi_fb(job->fb)->obj);
+}
+
+static void evdi_writeback_atomic_commit(struct drm_connector *connector,
+					 struct drm_atomic_state *state)
+{
+	struct drm_connector_state *conn_state =
+		drm_atomic_get_new_connector_state(state, connector);
+	struct evdi_writeback *writeback = to_evdi_writeback(connector);
+	struct evdi_device *evdi = connector->dev->dev_private;
+	struct evdi_writeback_work *wb_work;
+	struct drm_framebuffer *fb;
+
+	if (!conn_state->writeback_job || !conn_state->writeback_job->fb)
+		return;
+
+	/* The job keeps its framebuffer until completion is signalled */
+	fb = conn_state->writeback_job->fb;
+	drm_writeback_queue_job(&writeback->base, conn_state);
+
+	wb_work = kzalloc(sizeof(*wb_work), GFP_KERNEL);
+	if (!wb_work) {
+		drm_writeback_signal_completion(&writeback->base, -ENOMEM);
+		return;
+	}
+
+	wb_work->writeback = writeback;
+	wb_work->efb = to_evdi_fb(fb);
+	INIT_WORK(&wb_work->work, evdi_writeback_work_fn);
+	queue_work(evdi->commit_wq, &wb_work->work);
+}
+
+static const struct drm_connector_helper_funcs evdi_writeback_helper_funcs = {
+	.get_modes = evdi_writeback_get_modes,
+	.prepare_writeback_job = evdi_writeback_prepare_job,
+	.cleanup_writeback_job = evdi_writeback_cleanup_job,
+	.atomic_commit = evdi_writeback_atomic_commit,
+};
+
+static void evdi_writeback_destroy(struct drm_connector *connector)
+{
+	struct evdi_writeback *writeback = to_evdi_writeback(connector);
+
+	drm_connector_cleanup(connector);
+	kfree(writeback);
+}
+
+static const struct drm_connector_funcs evdi_writeback_connector_funcs = {
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = evdi_writeback_destroy,
+	.reset = drm_atomic_helper_connector_reset,
+	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+};
+
+/* The CRTC shows frames at the size of its mode, whatever the rotation */
+static int evdi_writeback_atomic_check(__always_unused struct drm_encoder *encoder,
+				       struct drm_crtc_state *crtc_state,
+				       struct drm_connector_state *conn_state)
+{
+	struct drm_framebuffer *fb;
+
+	if (!conn_state->writeback_job || !conn_state->writeback_job->fb)
+		return 0;
+
+	fb = conn_state->writeback_job->fb;
+	if (fb->width != crtc_state->mode.hdisplay ||
+	    fb->height != crtc_state->mode.vdisplay) {
+		EVDI_DEBUG("Writeback buffer %ux%u does not match the mode\n",
+			   fb->width, fb->height);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static const struct drm_encoder_helper_funcs evdi_writeback_encoder_helper_funcs = {
+	.atomic_check = evdi_writeback_atomic_check,
+};
+
+int evdi_writeback_init(struct drm_device *dev, struct evdi_head *head)
+{
+	struct evdi_writeback *writeback;
+	int ret;
+
+	writeback = kzalloc(sizeof(*writeback), GFP_KERNEL);
+	if (!writeback)
+		return -ENOMEM;
+	writeback->head = head;
+
+	ret = drm_writeback_connector_init(dev, &writeback->base,
+					   &evdi_writeback_connector_funcs,
+					   &evdi_writeback_encoder_helper_funcs,
+					   evdi_writeback_formats,
+					   ARRAY_SIZE(evdi_writeback_formats),
+					   BIT(head->index));
+	if (ret) {
+		EVDI_ERROR("Failed to add writeback connector: %d\n", ret);
+		kfree(writeback);
+		return ret;
+	}
+	drm_connector_helper_add(&writeback->base.base,
+				 &evdi_writeback_helper_funcs);
+
+	return 0;
+}
+#endif
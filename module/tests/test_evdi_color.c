@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+
+#include <kunit/test.h>
+#include <drm/drm_fourcc.h>
+#include "evdi_color.h"
+
+#define CTM_ONE (1ULL << 32)
+
+static const struct drm_color_lut identity_lut[] = {
+	{ .red = 0, .green = 0, .blue = 0 },
+	{ .red = 0xffff, .green = 0xffff, .blue = 0xffff },
+};
+
+static const struct drm_color_lut inverted_lut[] = {
+	{ .red = 0xffff, .green = 0xffff, .blue = 0xffff },
+	{ .red = 0, .green = 0, .blue = 0 },
+};
+
+static void test_evdi_color_is_identity_without_blobs(struct kunit *test)
+{
+	KUNIT_EXPECT_NULL(test, evdi_color_create(NULL, 0, NULL, NULL, 0));
+}
+
+static void test_evdi_color_is_identity_for_identity_blobs(struct kunit *test)
+{
+	const struct drm_color_ctm ctm = {
+		.matrix = { CTM_ONE, 0, 0, 0, CTM_ONE, 0, 0, 0, CTM_ONE },
+	};
+
+	KUNIT_EXPECT_NULL(test, evdi_color_create(identity_lut, 2, &ctm,
+						  identity_lut, 2));
+}
+
+static void test_evdi_color_gamma_inverts_xrgb8888(struct kunit *test)
+{
+	struct evdi_color *color = evdi_color_create(NULL, 0, NULL,
+						     inverted_lut, 2);
+	uint32_t pixels[] = { 0xff102030, 0x00000000 };
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_XRGB8888, pixels, 2);
+
+	KUNIT_EXPECT_EQ(test, pixels[0], 0xffefdfcf);
+	KUNIT_EXPECT_EQ(test, pixels[1], 0x00ffffff);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_degamma_inverts_rgb565(struct kunit *test)
+{
+	struct evdi_color *color = evdi_color_create(inverted_lut, 2, NULL,
+						     NULL, 0);
+	uint16_t pixel = 0xf800;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_RGB565, &pixel, 1);
+
+	KUNIT_EXPECT_EQ(test, pixel, 0x07ff);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_keeps_xrgb2101010_padding(struct kunit *test)
+{
+	struct evdi_color *color = evdi_color_create(NULL, 0, NULL,
+						     inverted_lut, 2);
+	uint32_t pixel = 0xc0000000;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_XRGB2101010, &pixel, 1);
+
+	KUNIT_EXPECT_EQ(test, pixel, 0xffffffff);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_ctm_swaps_red_and_blue(struct kunit *test)
+{
+	const struct drm_color_ctm ctm = {
+		.matrix = { 0, 0, CTM_ONE, 0, CTM_ONE, 0, CTM_ONE, 0, 0 },
+	};
+	struct evdi_color *color = evdi_color_create(NULL, 0, &ctm, NULL, 0);
+	uint32_t xrgb = 0x00102030;
+	uint32_t xbgr = 0x00102030;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_XRGB8888, &xrgb, 1);
+	evdi_color_apply_row(color, DRM_FORMAT_XBGR8888, &xbgr, 1);
+
+	KUNIT_EXPECT_EQ(test, xrgb, 0x00302010);
+	KUNIT_EXPECT_EQ(test, xbgr, 0x00302010);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_ctm_keeps_xrgb2101010_components(struct kunit *test)
+{
+	const struct drm_color_ctm ctm = {
+		.matrix = { 0, 0, CTM_ONE, 0, CTM_ONE, 0, CTM_ONE, 0, 0 },
+	};
+	struct evdi_color *color = evdi_color_create(NULL, 0, &ctm, NULL, 0);
+	uint32_t pixel = 0x3ff << 20 | 0x201 << 10 | 0x001;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_XRGB2101010, &pixel, 1);
+
+	KUNIT_EXPECT_EQ(test, pixel, 0x001 << 20 | 0x201 << 10 | 0x3ff);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_ctm_clamps_negative_values(struct kunit *test)
+{
+	const struct drm_color_ctm ctm = {
+		.matrix = { CTM_ONE | BIT_ULL(63), 0, 0,
+			    0, CTM_ONE, 0,
+			    0, 0, CTM_ONE },
+	};
+	struct evdi_color *color = evdi_color_create(NULL, 0, &ctm, NULL, 0);
+	uint32_t pixel = 0x00ff8040;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_XRGB8888, &pixel, 1);
+
+	KUNIT_EXPECT_EQ(test, pixel, 0x00008040);
+	evdi_color_put(color);
+}
+
+static void test_evdi_color_leaves_nv12_untouched(struct kunit *test)
+{
+	struct evdi_color *color = evdi_color_create(NULL, 0, NULL,
+						     inverted_lut, 2);
+	uint8_t luma[4] = { 16, 64, 128, 235 };
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, color);
+	evdi_color_apply_row(color, DRM_FORMAT_NV12, luma, 4);
+
+	KUNIT_EXPECT_EQ(test, luma[0], 16);
+	KUNIT_EXPECT_EQ(test, luma[3], 235);
+	evdi_color_put(color);
+}
+
+static struct kunit_case evdi_color_test_cases[] = {
+	KUNIT_CASE(test_evdi_color_is_identity_without_blobs),
+	KUNIT_CASE(test_evdi_color_is_identity_for_identity_blobs),
+	KUNIT_CASE(test_evdi_color_gamma_inverts_xrgb8888),
+	KUNIT_CASE(test_evdi_color_degamma_inverts_rgb565),
+	KUNIT_CASE(test_evdi_color_keeps_xrgb2101010_padding),
+	KUNIT_CASE(test_evdi_color_ctm_swaps_red_and_blue),
+	KUNIT_CASE(test_evdi_color_ctm_keeps_xrgb2101010_components),
+	KUNIT_CASE(test_evdi_color_ctm_clamps_negative_values),
+	KUNIT_CASE(test_evdi_color_leaves_nv12_untouched),
+	{}
+};
+
+static struct kunit_suite evdi_color_test_suite = {
+	.name = "drm_evdi_color_tests",
+	.test_cases = evdi_color_test_cases,
+};
+
+kunit_test_suite(evdi_color_test_suite);
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2024 DisplayLink (UK) Ltd.
+ *
+ * This file is subject to the terms and conditions of the GNU General Public
+ * License v2. See the file COPYING in the main directory of this archive for
+ * more details.
+ */
+
+
+#include <kunit/test.h>
+#include "evdi_damage.h"
+
+
+static int suite_test_damage_init(struct kunit *test)
+{
+	struct evdi_damage *damage = kunit_kzalloc(test, sizeof(struct evdi_damage), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, damage);
+	evdi_damage_init(damage);
+	evdi_damage_set_size(damage, 1920, 1080);
+	test->priv = damage;
+
+	return 0;
+}
+
+static void test_evdi_damage_is_empty_after_init(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	KUNIT_EXPECT_EQ(test, evdi_damage_pending(damage), 0);
+	KUNIT_EXPECT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 0);
+}
+
+static void test_evdi_damage_is_not_added_without_size(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect rect = { 0, 0, 10, 10 };
+
+	evdi_damage_set_size(damage, 0, 0);
+
+	KUNIT_EXPECT_FALSE(test, evdi_damage_add(damage, &rect));
+	KUNIT_EXPECT_EQ(test, evdi_damage_pending(damage), 0);
+}
+
+static void test_evdi_damage_rect_is_aligned_to_tiles(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect rect = { 40, 40, 50, 50 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	KUNIT_EXPECT_TRUE(test, evdi_damage_add(damage, &rect));
+	KUNIT_ASSERT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 1);
+
+	KUNIT_EXPECT_EQ(test, rects[0].x1, 32);
+	KUNIT_EXPECT_EQ(test, rects[0].y1, 32);
+	KUNIT_EXPECT_EQ(test, rects[0].x2, 64);
+	KUNIT_EXPECT_EQ(test, rects[0].y2, 64);
+}
+
+static void test_evdi_damage_rect_is_clipped_to_size(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect rect = { 1900, 1070, 4000, 4000 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	evdi_damage_add(damage, &rect);
+	KUNIT_ASSERT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 1);
+
+	KUNIT_EXPECT_EQ(test, rects[0].x1, 1888);
+	KUNIT_EXPECT_EQ(test, rects[0].y1, 1056);
+	KUNIT_EXPECT_EQ(test, rects[0].x2, 1920);
+	KUNIT_EXPECT_EQ(test, rects[0].y2, 1080);
+}
+
+static void test_evdi_damage_take_clears_damage(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect rect = { 0, 0, 1920, 1080 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	evdi_damage_add(damage, &rect);
+	KUNIT_EXPECT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 1);
+
+	KUNIT_EXPECT_EQ(test, evdi_damage_pending(damage), 0);
+	KUNIT_EXPECT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 0);
+}
+
+static void test_evdi_damage_peek_keeps_damage(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect rect = { 0, 0, 100, 100 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	evdi_damage_add(damage, &rect);
+
+	KUNIT_EXPECT_EQ(test, evdi_damage_peek(damage, rects, EVDI_DAMAGE_MAX_RECTS), 1);
+	KUNIT_EXPECT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 1);
+}
+
+static void test_evdi_damage_distant_rects_are_kept_apart(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect top_left = { 0, 0, 32, 32 };
+	const struct drm_clip_rect bottom_right = { 1888, 1048, 1920, 1080 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	evdi_damage_add(damage, &top_left);
+	evdi_damage_add(damage, &bottom_right);
+
+	KUNIT_EXPECT_EQ(test, evdi_damage_take(damage, rects, EVDI_DAMAGE_MAX_RECTS), 2);
+}
+
+static void test_evdi_damage_is_collapsed_when_rects_do_not_fit(struct kunit *test)
+{
+	struct evdi_damage *damage = test->priv;
+	const struct drm_clip_rect top_left = { 0, 0, 32, 32 };
+	const struct drm_clip_rect bottom_right = { 1888, 1048, 1920, 1080 };
+	struct drm_clip_rect rects[EVDI_DAMAGE_MAX_RECTS];
+
+	evdi_damage_add(damage, &top_left);
+	evdi_damage_add(damage, &bottom_right);
+
+	KUNIT_ASSERT_EQ(test, evdi_damage_take(damage, rects, 1), 1);
+	KUNIT_EXPECT_EQ(test, rects[0].x1, 0);
+	KUNIT_EXPECT_EQ(test, rects[0].y1, 0);
+	KUNIT_EXPECT_EQ(test, rects[0].x2, 1920);
+	KUNIT_EXPECT_EQ(test, rects[0].y2, 1080);
+}
+
+static struct kunit_case evdi_damage_test_cases[] = {
+	KUNIT_CASE(test_evdi_damage_is_empty_after_init),
+	KUNIT_CASE(test_evdi_damage_is_not_added_without_size),
+	KUNIT_CASE(test_evdi_damage_rect_is_aligned_to_tiles),
+	KUNIT_CASE(test_evdi_damage_rect_is_clipped_to_size),
+	KUNIT_CASE(test_evdi_damage_take_clears_damage),
+	KUNIT_CASE(test_evdi_damage_peek_keeps_damage),
+	KUNIT_CASE(test_evdi_damage_distant_rects_are_kept_apart),
+	KUNIT_CASE(test_evdi_damage_is_collapsed_when_rects_do_not_fit),
+	{}
+};
+
+static struct kunit_suite evdi_damage_test_suite = {
+	.name = "drm_evdi_damage_tests",
+	.test_cases = evdi_damage_test_cases,
+	.init = suite_test_damage_init,
+};
+
+kunit_test_suite(evdi_damage_test_suite);
@@ -9,28 +9,31 @@
 
 int Buffer::numerator = 0;
 
+static constexpr unsigned int fourcc_nv12 =
+	'N' | ('V' << 8) | ('1' << 16) | ('2' << 24);
+
 Buffer::Buffer(evdi_mode mode, evdi_handle evdiHandle)
 {
 	int id = numerator++;
+	// NV12 rows are 8 bit luma, followed by half as many rows of chroma
+	const bool is_nv12 = mode.pixel_format == fourcc_nv12;
+	const int rows = is_nv12 ? mode.height + (mode.height + 1) / 2 :
+				   mode.height;
 
 	this->evdiHandle = evdiHandle;
-	int stride = mode.width;
-	int pitch_mask = 63;
-
-	stride += pitch_mask;
-	stride &= ~pitch_mask;
-	stride *= 4;
+	int stride = evdi_get_buffer_pitch(evdiHandle, mode.width,
+					   is_nv12 ? 8 : mode.bits_per_pixel);
 
 	buffer.id = id;
 	buffer.width = mode.width;
-	buffer.height = mode.height;
+	buffer.height = rows;
 	buffer.stride = stride;
 	buffer.rect_count = 16;
 	buffer.rects = reinterpret_cast<evdi_rect *>(
 		calloc(buffer.rect_count, sizeof(struct evdi_rect)));
 	rects_span = std::span<evdi_rect>(buffer.rects, buffer.rect_count);
 	bytes_per_pixel = mode.bits_per_pixel / 8;
-	buffer_size = mode.width * mode.height * bytes_per_pixel;
+	buffer_size = stride * rows;
 	buffer.buffer = calloc(1, buffer_size);
 	buffer_span =
 		std::span<uint32_t>(reinterpret_cast<uint32_t *>(buffer.buffer),